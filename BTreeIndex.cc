@@ -6,21 +6,54 @@
  * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
  * @date 3/24/2008
  */
- 
+
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
-#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <queue>
 
 using namespace std;
 
+//
+// Page 0 of the index file stores the root pid and the height of the
+// tree. The nodes of the tree are stored from page 1.
+// The header starts with a magic string and the version of the node
+// format, so that open() rejects index files of another format instead
+// of misreading their nodes.
+//
+static const char INDEX_MAGIC[8] = "BRUINBT";
+static const int  INDEX_VERSION = 3;   // version 2 had no child entry counts
+
+struct IndexHeader {
+  char   magic[8];    // INDEX_MAGIC
+  int    version;     // INDEX_VERSION
+  PageId rootPid;     // the root node, or -1 if the tree is empty
+  int    treeHeight;  // 0 if empty, 1 if the root is a leaf node
+};
+
+// # of pairs sorted in memory by bulk loading before a run is spilled
+static const size_t BULK_RUN_ENTRIES = 1 << 20;
+
+// the order of the pairs in the leaf nodes
+static bool entryLess(const IndexEntry& a, const IndexEntry& b)
+{
+  if (a.key != b.key) return a.key < b.key;
+  return a.rid < b.rid;
+}
+
 /*
  * BTreeIndex constructor
  */
 BTreeIndex::BTreeIndex()
 {
     rootPid = -1;
-    memset(buffer, 0, PageFile::PAGE_SIZE);
-
+    treeHeight = 0;
+    writable = false;
+    bulkLoading = false;
+    bulkFill = DEFAULT_FILL_PERCENT;
+    bulkCount = 0;
 }
 
 /*
@@ -32,41 +65,45 @@ BTreeIndex::BTreeIndex()
  */
 RC BTreeIndex::open(const string& indexname, char mode)
 {
-    //PageFile pf(indexname, mode);
-    // char buffer[PageFile::PAGE_SIZE];
-    // memset(buffer, 0, PageFile::PAGE_SIZE);
+    RC rc;
 
-    if (pf.open (indexname, mode) !=0) {
-        cout << "BTreeIndex :: open -- cannot open index file" << endl;
-    	return 1; 
-    }
-
-    cout << "BTreeIndex :: open -- endPid: " << pf.endPid() << endl;
+    if ((rc = pf.open(indexname, mode)) < 0)
+        return rc;
+    writable = (mode == 'w' || mode == 'W');
 
     //if file is empty, initialize rootPid & treeHeight
-    if (pf.endPid()==0)
+    if (pf.endPid() == 0)
     {
         rootPid = -1;
         treeHeight = 0;
-        if (pf.write(0, buffer) != 0)
+        if (!writable)
         {
-            cout << "BTreeIndex :: open -- cannot write to pf" << endl;
-           return RC_FILE_WRITE_FAILED;
+            pf.close();
+            return RC_INVALID_FILE_FORMAT;
         }
     }
 
     else {
-        if (pf.read(0, buffer) != 0)
+        PinnedPage page;
+        if ((rc = page.pin(pf, 0)) < 0)
+        {
+            pf.close();
+            return rc;
+        }
+        const IndexHeader* header = (const IndexHeader*) page.data();
+        if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != INDEX_VERSION)
         {
-            cout << "BTreeIndex :: open -- cannot read pf" << endl;
-            return 1;
+            page.release();
+            pf.close();
+            return RC_INVALID_FILE_FORMAT;
         }
-        rootPid = *((PageId *)buffer);
-        treeHeight = *((int *)(buffer + sizeof(PageId)));
+        rootPid = header->rootPid;
+        treeHeight = header->treeHeight;
     }
 
-    cout << "BTreeIndex :: open -- rootPid: " << rootPid << endl;
-    cout << "BTreeIndex :: open -- treeHeight: " << treeHeight << endl;
+    // index lookups jump between nodes, so reading ahead does not help
+    pf.setAccessPattern(PageFile::ACCESS_RANDOM);
     return 0;
 }
 
@@ -76,157 +113,130 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
-    // char buffer[PageFile::PAGE_SIZE];
-    // memset(buffer, 0, PageFile::PAGE_SIZE);
-    buffer[0] = (PageId)rootPid;
-    buffer[sizeof(PageId)] = (int)treeHeight;
-
-    if (pf.write(0, buffer) != 0 ) {
-        cout<< "BTreeIndex::close failed" <<endl;
-        return RC_FILE_WRITE_FAILED;
+    RC rc;
+
+    discardBulkRuns();
+
+    // store the root pid and the tree height in page 0
+    if (writable)
+    {
+        char buffer[PageFile::MAX_PAGE_SIZE];
+        IndexHeader header;
+
+        memset(buffer, 0, pf.getPageSize());
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.rootPid = rootPid;
+        header.treeHeight = treeHeight;
+        memcpy(buffer, &header, sizeof(header));
+        if ((rc = pf.write(0, buffer)) < 0)
+        {
+            pf.close();
+            return rc;
+        }
     }
+    writable = false;
     return pf.close();
 }
 
+/*
+ * Record the entry count of the child pid in the node that holds it after
+ * a split: node itself or its new sibling.
+ */
+static void setChildCount(BTNonLeafNode& node, BTNonLeafNode& sibling, PageId pid, int count)
+{
+  if (node.setChildCount(pid, count) < 0)
+    sibling.setChildCount(pid, count);
+}
 
 /*
-* IN: key passed in from insert
-* IN: rid passed in from insert
-* OUT: overflow -- whether the last insert caused an overflow
-* IN: height of the node that we're currently looking at
-* IN: pid that we're currently looking at
-* OUT: siblingPid -- new pid of the sibling after splitting
-* OUT: siblingKey -- equivalent to midKey in insertAndSplit, needed to insert into parent node
-*/
-
-// RC BTreeIndex::insertHelp (int key, const RecordId& rid, bool& overflow, int height, PageId pid, PageId& siblingPid, int& siblingKey) {
-
-//     overflow = false;
-//     if (height == treeHeight) //leaf node, base case.
-//     {
-//         BTLeafNode leaf;
-//         leaf.read(pid, pf);
-//         if (leaf.insert(key, rid) == RC_NODE_FULL)
-//         {
-//             overflow = true;
-//             BTLeafNode siblingLeaf;
-//             if (leaf.insertAndSplit(key, rid, siblingLeaf, siblingKey))
-//             {
-//                 return 1; //ERROR IN SPLIT
-//             }
-//             siblingPid = pf.endPid();
-//             siblingLeaf.setNextNodePtr(leaf.getNextNodePtr());
-//             leaf.setNextNodePtr(siblingPid);
-
-//             if (siblingLeaf.write(siblingPid, pf))
-//             {
-//                 return RC_FILE_WRITE_FAILED;
-//             }
-//             if (leaf.write(pid, pf))
-//             {
-//                 return RC_FILE_WRITE_FAILED;
-//             }
-//         }
-//     }
-
-//     else { //nonleaf node
-//         BTNonLeafNode nonleaf;
-//         PageId childPid;
-
-//         nonleaf.read(pid, pf);
-//         nonleaf.locateChildPtr(key, childPid);
-//         insertHelp(key, rid, overflow, height+1, childPid, siblingPid, siblingKey);
-
-//         if (overflow)
-//         {
-//             if (nonleaf.insert(siblingKey, siblingPid)) //nonleaf full
-//             {
-
-//                 BTNonLeafNode siblingNonLeaf;
-//                 int midKey;                
-
-//                 if (siblingNonLeaf.insertAndSplit(siblingKey, siblingPid, siblingNonLeaf, midKey))
-//                 {
-//                     return 1; //ERROR IN SPLIT. TOO BAD.
-//                 }
-//                 siblingKey = midKey;
-//                 siblingPid = pf.endPid();
-//                 if (siblingNonLeaf.write(siblingPid, pf))
-//                 {
-//                     return RC_FILE_WRITE_FAILED;
-//                 }
-//             }
-//             else {
-//                 overflow = false;
-//             }
-//             nonleaf.write(pid, pf);
-//         }
-//     }
-//     return 0;
-// }
-
-RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId pid, int height, int& ofKey, PageId& ofPid)
+ * Insert (key, rid) into the subtree rooted at the node pid.
+ * If the node overflows, it is split and the key and the page of the new
+ * sibling are returned in ofKey and ofPid, so that the parent can insert
+ * them. Otherwise ofPid is set to -1.
+ * The number of entries under the node (and under the new sibling) are
+ * returned, so that the parent can update the entry counts of its children.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @param pid[IN] the root of the subtree
+ * @param height[IN] the level of the node pid (the root is at level 1)
+ * @param count[OUT] the number of entries under the node pid
+ * @param ofKey[OUT] the first key of the new sibling
+ * @param ofPid[OUT] the page of the new sibling, or -1
+ * @param ofCount[OUT] the number of entries under the new sibling
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId pid, int height,
+                            int& count, int& ofKey, PageId& ofPid, int& ofCount)
 {
-  ofKey = -1;
+  RC rc;
+
+  ofPid = -1;
+  ofCount = 0;
 
   // Base case: at leaf node
   if (height == treeHeight)
   {
     BTLeafNode ln;
-    ln.read(pid, pf);
-    if (ln.insert(key, rid))
+    if ((rc = ln.read(pid, pf)) < 0)
+      return rc;
+    if (ln.insert(key, rid) == RC_NODE_FULL)
     {
       // Overflow. Create new leaf node and split.
-      BTLeafNode newNode;
-      if (ln.insertAndSplit(key, rid, newNode, ofKey))
-        return 1;
+      BTLeafNode newNode(pf.getPageSize());
+      if ((rc = ln.insertAndSplit(key, rid, newNode, ofKey)) < 0)
+        return rc;
 
       // Set new nextNode pointers
       ofPid = pf.endPid();
       newNode.setNextNodePtr(ln.getNextNodePtr());
       ln.setNextNodePtr(ofPid);
 
-      if (newNode.write(ofPid, pf))
-        return 1;
+      if ((rc = newNode.write(ofPid, pf)) < 0)
+        return rc;
+      ofCount = newNode.getKeyCount();
     }
-    if (ln.write(pid, pf))
-      return 1;
+    count = ln.getKeyCount();
+    return ln.write(pid, pf);
   }
+
   // Recursive: At non-leaf node
-  else
+  BTNonLeafNode nln;
+  BTNonLeafNode sibling(pf.getPageSize());
+  PageId child;
+  int childCount, childOfKey, childOfCount;
+  PageId childOfPid;
+
+  if ((rc = nln.read(pid, pf)) < 0)
+    return rc;
+  nln.locateChildPtr(key, child);
+  if ((rc = insertHelper(key, rid, child, height+1, childCount, childOfKey, childOfPid, childOfCount)) < 0)
+    return rc;
+
+  // Child node overflowed. Insert (key,pid) into this node.
+  // The new child goes right after the child, even if other keys are
+  // equal to childOfKey.
+  if (childOfPid >= 0 && nln.insert(childOfKey, childOfPid, child) == RC_NODE_FULL)
   {
-    BTNonLeafNode nln;
-    int eid;
-    PageId child;
-
-    nln.read(pid, pf);
-    nln.locateChildPtr(key, child);
-    // nln.readEntry(eid, child);
-    insertHelper (key, rid, child, height+1, ofKey, ofPid);
-    if (ofKey > 0)
-    {
-      // Child node overflowed. Insert (key,pid) into this node.
-      if (nln.insert(ofKey, ofPid))
-      {
-        // Non-leaf node overflow. Split node between siblings.
-        int midKey;
-        BTNonLeafNode sibling;
-
-        if (nln.insertAndSplit(ofKey, ofPid, sibling, midKey))
-          return 1;
-        ofKey = midKey;
-        ofPid = pf.endPid();
-        if (sibling.write(ofPid, pf))
-          return 1;
-      }
-      else
-      {
-        ofKey = -1;
-      }
-      nln.write(pid, pf);
-    }
+    // Non-leaf node overflow. Split node between siblings.
+    if ((rc = nln.insertAndSplit(childOfKey, childOfPid, sibling, ofKey, child)) < 0)
+      return rc;
+    ofPid = pf.endPid();
   }
-  return 0;
+
+  // the entry counts of the child and its new sibling
+  setChildCount(nln, sibling, child, childCount);
+  if (childOfPid >= 0)
+    setChildCount(nln, sibling, childOfPid, childOfCount);
+
+  if (ofPid >= 0)
+  {
+    if ((rc = sibling.write(ofPid, pf)) < 0)
+      return rc;
+    ofCount = sibling.getEntryCount();
+  }
+  count = nln.getEntryCount();
+  return nln.write(pid, pf);
 }
 
 /*
@@ -235,91 +245,290 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId pid, int height
  * @param rid[IN] the RecordId for the record being inserted into the index
  * @return error code. 0 if no error
  */
-// RC BTreeIndex::insert(int key, const RecordId& rid)
-// {
-//     if (treeHeight == 0) //initialize root node
-//     {
-//         BTLeafNode leaf;
-//         leaf.insert(key, rid);
-//         rootPid = pf.endPid();
-//         treeHeight = 1;
-//         leaf.write(rootPid, pf);
-//         return 0;
-//     }
-
-//     bool overflow = false;
-//     PageId siblingPid = -1;
-//     int siblingKey = -1;
-
-// if (insertHelper(key, rid, rootPid, 1, siblingKey, siblingPid))
-// {
-//     return 1;
-// }
-//     // if (insertHelp(key, rid, overflow, 1, rootPid, siblingPid, siblingKey))
-//     // {
-//     //     return 1; // ERROR SOMEHWERE IN INSERT TOO BAD SO SAD.
-//     // }
-
-//     //new root node cus of overflow
-//     if (overflow)
-//     {
-//         cout << "BTreeIndex :: insert -- in overflow if block" << endl;
-//         BTNonLeafNode root;
-//         rootPid = pf.endPid();
-//         root.initializeRoot(rootPid, siblingKey, siblingPid);
-//         treeHeight++;
-//         if (root.write (rootPid, pf)) {
-//             cout << "BTreeIndex :: insert -- overflow new root write failed" << endl;
-//             return RC_FILE_WRITE_FAILED;
-//         }
-//     }
-//     return 0;
-// }
-
-
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
-  int ofKey;
+  RC rc;
+  int count, ofKey, ofCount;
   PageId ofPid;
 
   //If new index, simply add a root node
   if (treeHeight == 0)
   {
-    BTLeafNode ln;
+    BTLeafNode ln(pf.getPageSize());
     ln.insert(key, rid);
-    rootPid = pf.endPid();
+    rootPid = max(pf.endPid(), 1);
+    if ((rc = ln.write(rootPid, pf)) < 0)
+      return rc;
     treeHeight = 1;
-    ln.write(rootPid, pf);
     return 0;
   }
 
-  if (insertHelper(key, rid, rootPid, 1, ofKey, ofPid))
-    return 1;
+  if ((rc = insertHelper(key, rid, rootPid, 1, count, ofKey, ofPid, ofCount)) < 0)
+    return rc;
 
   // If overflow at top level, create new root node
-  if (ofKey > 0)
+  if (ofPid >= 0)
   {
-    BTNonLeafNode newRoot;
+    BTNonLeafNode newRoot(pf.getPageSize());
     newRoot.initializeRoot(rootPid, ofKey, ofPid);
-    rootPid = pf.endPid();
+    newRoot.setChildCount(rootPid, count);
+    newRoot.setChildCount(ofPid, ofCount);
+    PageId newRootPid = pf.endPid();
+    if ((rc = newRoot.write(newRootPid, pf)) < 0)
+      return rc;
+    rootPid = newRootPid;
     treeHeight++;
-    newRoot.write(rootPid, pf);
   }
-  cout << "BTreeIndex :: insert -- treeHeight: " << treeHeight << endl << endl;
   return 0;
 }
+
+RC BTreeIndex::beginBulkLoad(int fillPercent)
+{
+  if (!writable || treeHeight != 0 || bulkLoading)
+    return RC_INVALID_FILE_MODE;
+
+  bulkLoading = true;
+  bulkFill = min(max(fillPercent, 1), 100);
+  bulkCount = 0;
+  bulkEntries.clear();
+  return 0;
+}
+
+RC BTreeIndex::bulkInsert(int key, const RecordId& rid)
+{
+  RC rc;
+  IndexEntry entry;
+
+  if (!bulkLoading)
+    return RC_INVALID_FILE_MODE;
+
+  entry.key = key;
+  entry.rid = rid;
+  bulkEntries.push_back(entry);
+  bulkCount++;
+
+  // sort the pairs in memory and spill them when the buffer is full
+  if (bulkEntries.size() >= BULK_RUN_ENTRIES && (rc = spillBulkRun()) < 0)
+    return rc;
+  return 0;
+}
+
+/*
+ * Sort the pairs collected in memory and write them to a temporary file.
+ */
+RC BTreeIndex::spillBulkRun()
+{
+  FILE* run = tmpfile();
+  if (run == NULL)
+    return RC_FILE_OPEN_FAILED;
+  bulkRuns.push_back(run);
+
+  sort(bulkEntries.begin(), bulkEntries.end(), entryLess);
+  if (fwrite(&bulkEntries[0], sizeof(IndexEntry), bulkEntries.size(), run) != bulkEntries.size())
+    return RC_FILE_WRITE_FAILED;
+  bulkEntries.clear();
+  return 0;
+}
+
+void BTreeIndex::discardBulkRuns()
+{
+  for (size_t i = 0; i < bulkRuns.size(); i++)
+    fclose(bulkRuns[i]);
+  bulkRuns.clear();
+  vector<IndexEntry>().swap(bulkEntries);
+  bulkLoading = false;
+}
+
+//
+// The sorted stream of the bulk loaded pairs. If no run was spilled, the
+// pairs are read from memory. Otherwise the runs are merged with a heap
+// that holds the smallest unread pair of every run.
+//
+class BulkSource {
+ public:
+  BulkSource(vector<IndexEntry>& memory, vector<FILE*>& runs)
+    : memory(memory), runs(runs), next(0) {}
+
+  RC open()
+  {
+    for (size_t i = 0; i < runs.size(); i++) {
+      rewind(runs[i]);
+      if (!fill(i)) return RC_FILE_READ_FAILED;
+    }
+    return 0;
+  }
+
+  // read the next pair in sorted order. returns false at the end
+  bool read(IndexEntry& entry)
+  {
+    if (runs.empty()) {
+      if (next >= memory.size()) return false;
+      entry = memory[next++];
+      return true;
+    }
+
+    if (heap.empty()) return false;
+    entry = heap.top().entry;
+    size_t run = heap.top().run;
+    heap.pop();
+    fill(run);
+    return true;
+  }
+
+ private:
+  struct HeapItem {
+    IndexEntry entry;
+    size_t     run;
+    bool operator<(const HeapItem& other) const {
+      return entryLess(other.entry, entry);  // the smallest on top
+    }
+  };
+
+  // put the next pair of a run in the heap. returns false at its end
+  bool fill(size_t run)
+  {
+    HeapItem item;
+    if (fread(&item.entry, sizeof(IndexEntry), 1, runs[run]) != 1) return false;
+    item.run = run;
+    heap.push(item);
+    return true;
+  }
+
+  vector<IndexEntry>& memory;
+  vector<FILE*>&      runs;
+  size_t              next;   // the next pair in memory
+  priority_queue<HeapItem> heap;
+};
+
+// the first key, the page and the # of entries of a node on the level being built
+typedef struct {
+  int    key;
+  PageId pid;
+  int    count;
+} NodeRef;
+
+/*
+ * Write the leaf nodes for count sorted pairs to consecutive pages
+ * starting at page pid. The pairs are spread evenly over as few leaves as
+ * the fill factor allows, and every leaf points to the next one.
+ */
+static RC writeLeaves(PageFile& pf, BulkSource& source, long long count,
+                      int fillPercent, PageId pid, vector<NodeRef>& level)
+{
+  RC rc;
+  IndexEntry entry;
+  int perNode = max(1, BTLeafNode(pf.getPageSize()).getMaxKeyCount() * fillPercent / 100);
+  long long nodes = (count + perNode - 1) / perNode;
+
+  for (long long n = 0; n < nodes; n++) {
+    BTLeafNode leaf(pf.getPageSize());
+    long long size = (count * (n + 1)) / nodes - (count * n) / nodes;
+    NodeRef ref;
+
+    for (long long i = 0; i < size; i++) {
+      if (!source.read(entry)) return RC_FILE_READ_FAILED;
+      if (i == 0) ref.key = entry.key;
+      leaf.insert(entry.key, entry.rid);
+    }
+    leaf.setNextNodePtr(n + 1 < nodes ? pid + 1 : -1);
+    if ((rc = leaf.write(pid, pf)) < 0) return rc;
+
+    ref.pid = pid++;
+    ref.count = size;
+    level.push_back(ref);
+  }
+  return 0;
+}
+
+/*
+ * Write the nonleaf nodes above the nodes in level to the end of the file
+ * and replace level with the new nodes.
+ */
+static RC writeNonLeafLevel(PageFile& pf, int fillPercent, vector<NodeRef>& level)
+{
+  RC rc;
+  vector<NodeRef> parents;
+  int perNode = max(2, BTNonLeafNode(pf.getPageSize()).getMaxKeyCount() * fillPercent / 100);
+  long long count = level.size();
+
+  // a node with k keys has k+1 children
+  long long nodes = (count + perNode) / (perNode + 1);
+
+  for (long long n = 0, i = 0; n < nodes; n++) {
+    BTNonLeafNode node(pf.getPageSize());
+    long long end = (count * (n + 1)) / nodes;
+    NodeRef ref;
+
+    ref.key = level[i].key;
+    ref.count = 0;
+    node.initializeRoot(level[i].pid, level[i+1].key, level[i+1].pid);
+    for (long long first = i; i < end; i++) {
+      if (i > first + 1)
+        node.insert(level[i].key, level[i].pid);
+      node.setChildCount(level[i].pid, level[i].count);
+      ref.count += level[i].count;
+    }
+
+    ref.pid = pf.endPid();
+    if ((rc = node.write(ref.pid, pf)) < 0) return rc;
+    parents.push_back(ref);
+  }
+
+  level.swap(parents);
+  return 0;
+}
+
+RC BTreeIndex::endBulkLoad()
+{
+  RC rc;
+  vector<NodeRef> level;
+
+  if (!bulkLoading)
+    return RC_INVALID_FILE_MODE;
+
+  // sort the pairs left in memory. if some runs were spilled, spill them
+  // too, so that all pairs are merged from the runs
+  if (bulkRuns.empty())
+    sort(bulkEntries.begin(), bulkEntries.end(), entryLess);
+  else if (!bulkEntries.empty() && (rc = spillBulkRun()) < 0)
+    goto exit_bulk;
+
+  if (bulkCount > 0) {
+    BulkSource source(bulkEntries, bulkRuns);
+    if ((rc = source.open()) < 0)
+      goto exit_bulk;
+
+    // the leaves come first, in key order, so that range scans read them
+    // sequentially. each nonleaf level is written after the level below.
+    if ((rc = writeLeaves(pf, source, bulkCount, bulkFill, max(pf.endPid(), 1), level)) < 0)
+      goto exit_bulk;
+    treeHeight = 1;
+    while (level.size() > 1) {
+      if ((rc = writeNonLeafLevel(pf, bulkFill, level)) < 0)
+        goto exit_bulk;
+      treeHeight++;
+    }
+    rootPid = level[0].pid;
+  }
+  rc = 0;
+
+  exit_bulk:
+  discardBulkRuns();
+  return rc;
+}
+
 /*
- * Find the leaf-node index entry whose key value is larger than or 
+ * Find the leaf-node index entry whose key value is larger than or
  * equal to searchKey, and output the location of the entry in IndexCursor.
  * IndexCursor is a "pointer" to a B+tree leaf-node entry consisting of
  * the PageId of the node and the SlotID of the index entry.
  * Note that, for range queries, we need to scan the B+tree leaf nodes.
  * For example, if the query is "key > 1000", we should scan the leaf
  * nodes starting with the key value 1000. For this reason,
- * it is better to return the location of the leaf node entry 
+ * it is better to return the location of the leaf node entry
  * for a given searchKey, instead of returning the RecordId
  * associated with the searchKey directly.
- * Once the location of the index entry is identified and returned 
+ * Once the location of the index entry is identified and returned
  * from this function, you should call readForward() to retrieve the
  * actual (key, rid) pair from the index.
  * @param key[IN] the key to find.
@@ -327,64 +536,56 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
  *                    with the key value.
  * @return error code. 0 if no error.
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor) //might need to re-do
+RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
-    PageId childPid = -1;
-    // PageId pid = rootPid;
-    int currHeight = 0;
-    if (currHeight < treeHeight-1) {
-        BTNonLeafNode nonleaf;
-        nonleaf.read(rootPid, pf);
-        cout << "BTreeIndex :: locate -- nonleaf.read buffer_index: " << nonleaf.getBufferIndex() << endl;
-        while (currHeight < treeHeight-1) { // if it's a nonleaf node
-            nonleaf.locateChildPtr(searchKey, childPid);
-            currHeight++;
-        }
-        BTLeafNode leaf;
-        if (childPid > -1)
-        {
-            cout << "BTreeIndex :: locate -- childPid: " << childPid << endl;
-            leaf.read(childPid, pf);
-            cursor.pid = childPid;
-            leaf.locate(searchKey, cursor.eid);
-            return 0;
-        }
-    }
-    else { // root is a leaf node
-        cout << "BTreeIndex :: locate -- root is a leaf node" << endl;
-        BTLeafNode leaf;
-        if (leaf.read(rootPid, pf) != 0)
-        {
-            cout << "BTreeIndex :: locate -- cannot read rootNode :( " << endl;
-        }
-        cout << "BTreeIndex :: locate -- leaf properly read? buffer_index: " << leaf.getBufferIndex() << endl;
-        cursor.pid = rootPid;
-        leaf.locate(searchKey, cursor.eid);
-        return 0;
-    }
-    return 1;
+    RC rc;
+    PageId pid = rootPid;
 
+    cursor.pid = -1;
+    cursor.eid = 0;
+    if (treeHeight == 0)
+        return RC_NO_SUCH_RECORD;
 
-    // int leafPid;
-    // int currHeight = 1;
-    // while(currHeight < treeHeight) // stops when at leafnode
-    // {
-    //     cout << "BTreeIndex:: locate -- in while loop" << endl;
-    //     BTNonLeafNode nonleaf;
-    //     nonleaf.read(rootPid, pf);
-    //     nonleaf.locateChildPtr(searchKey, leafPid); // gets the pid of the next node
-    //     currHeight++;
-    // }
+    // follow the child pointers down to the leaf level
+    for (int height = 1; height < treeHeight; height++) {
+        BTNonLeafNode nonleaf;
+        if ((rc = nonleaf.read(pid, pf)) < 0)
+            return rc;
+        nonleaf.locateChildPtr(searchKey, pid);
+    }
 
-    // cout<<"BTreeIndex::locate leafPid: "<<leafPid<<endl;
+    if ((rc = readLeaf(cursor, pid)) < 0)
+        return rc;
 
-    // BTLeafNode leaf;
-    // leaf.read(leafPid, pf);
+    // if every key in the leaf is smaller, the cursor points past its
+    // last entry and readForward() continues from the next leaf
+    cursor.leaf.locate(searchKey, cursor.eid);
+    return 0;
+}
 
-    // // sets the cursor's values
-    // leaf.locate(searchKey, cursor.eid);
-    // cursor.pid = leafPid;
-    // return 0;
+/*
+ * Read the leaf pid into the cursor, and point the cursor to its first
+ * entry. The next leaf is prefetched, so that it is likely in memory by
+ * the time the cursor reaches it.
+ * @param cursor[IN/OUT] the cursor to move to the leaf
+ * @param pid[IN] the leaf node to read
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readLeaf(IndexCursor& cursor, PageId pid)
+{
+    RC rc;
+
+    cursor.pid = pid;
+    cursor.eid = 0;
+    cursor.leafPid = -1;
+    if ((rc = cursor.leaf.read(pid, pf)) < 0)
+        return rc;
+    cursor.leafPid = pid;
+
+    PageId next = cursor.leaf.getNextNodePtr();
+    if (next >= 0)
+        pf.prefetch(next, 1);
+    return 0;
 }
 
 /*
@@ -393,37 +594,109 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor) //might need to re-do
  * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
  * @param key[OUT] the key stored at the index cursor location.
  * @param rid[OUT] the RecordId stored at the index cursor location.
- * @return error code. 0 if no error
+ * @return error code. 0 if no error. RC_END_OF_TREE after the last entry
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
-    // Read in the page's buffer, into a local buffer
-    // cout<< "BTreeIndex:: readForward -- cursor.eid: " << cursor.eid << endl << "pid: " <<cursor.pid <<endl;
-    PageId searchPid = -1;
-    if (cursor.pid > -1)
-    {
-        searchPid = cursor.pid;
+    RC rc;
+
+    if (cursor.pid < 0)
+        return RC_END_OF_TREE;
+
+    // read the leaf only when the cursor enters it
+    if (cursor.leafPid != cursor.pid) {
+        int eid = cursor.eid;
+        if ((rc = readLeaf(cursor, cursor.pid)) < 0)
+            return rc;
+        cursor.eid = eid;
     }
-    // might need to check if leafnode
-    BTLeafNode node;
-    if (searchPid > -1 && searchPid < pf.endPid())
-    {
-        node.read(searchPid, pf);
+
+    // if the cursor is past the last entry of the leaf, move to the next one
+    while (cursor.eid >= cursor.leaf.getKeyCount()) {
+        PageId next = cursor.leaf.getNextNodePtr();
+        if (next < 0) {
+            cursor.pid = -1;
+            cursor.eid = 0;
+            return RC_END_OF_TREE;
+        }
+        if ((rc = readLeaf(cursor, next)) < 0)
+            return rc;
     }
 
-    int entryId = cursor.eid;
+    if ((rc = cursor.leaf.readEntry(cursor.eid, key, rid)) < 0)
+        return rc;
+    cursor.eid++;
+    return 0;
+}
+
+/*
+ * Count the index entries whose key is smaller than searchKey.
+ * Along the path to searchKey, the entries under the children before the
+ * path are added up, and then the smaller entries of the leaf.
+ * @param searchKey[IN] the key to compare with
+ * @param count[OUT] the number of entries with key < searchKey
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countSmaller(int searchKey, int& count)
+{
+    RC rc;
+    PageId pid = rootPid;
+    int preceding, eid;
+
+    count = 0;
+    if (treeHeight == 0)
+        return 0;
 
-    // iterating the cursor
-    // if it is the last eid, it will go to the next page in the pagefile
-    if(node.getKeyCount() <= entryId){ 
-        cursor.pid = node.getNextNodePtr();
-        cursor.eid = 0;
+    for (int height = 1; height < treeHeight; height++) {
+        BTNonLeafNode nonleaf;
+        if ((rc = nonleaf.read(pid, pf)) < 0)
+            return rc;
+        nonleaf.locateChildPtr(searchKey, pid, preceding);
+        count += preceding;
     }
-    else{
-        cursor.eid++;
+
+    BTLeafNode leaf;
+    if ((rc = leaf.read(pid, pf)) < 0)
+        return rc;
+    leaf.locate(searchKey, eid);
+    count += eid;
+    return 0;
+}
+
+/*
+ * Count the index entries whose key is in [lo, hi].
+ * @param lo[IN] the smallest key to count
+ * @param hi[IN] the largest key to count
+ * @param count[OUT] the number of entries with lo <= key <= hi
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countRange(int lo, int hi, int& count)
+{
+    RC rc;
+    int below, upTo;
+
+    count = 0;
+    if (lo > hi || treeHeight == 0)
+        return 0;
+
+    // the entries <= hi are the entries < hi+1, or all entries for INT_MAX
+    if (hi < INT_MAX) {
+        if ((rc = countSmaller(hi + 1, upTo)) < 0)
+            return rc;
+    } else if (treeHeight == 1) {
+        BTLeafNode root;
+        if ((rc = root.read(rootPid, pf)) < 0)
+            return rc;
+        upTo = root.getKeyCount();
+    } else {
+        BTNonLeafNode root;
+        if ((rc = root.read(rootPid, pf)) < 0)
+            return rc;
+        upTo = root.getEntryCount();
     }
 
-    // key and rid are updated with the corresponding inputted entryId
-    // returns a RC
-    return node.readEntry(entryId, key, rid);
+    if ((rc = countSmaller(lo, below)) < 0)
+        return rc;
+    count = upTo - below;
+    return 0;
 }
@@ -10,22 +10,42 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <cstdio>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and 
  * eid (the location of the index entry inside the node).
  * IndexCursor is used for index lookup and traversal.
+ * The cursor also holds the leaf node of pid, which is read once when the
+ * cursor enters the leaf and stays pinned until the cursor leaves it.
  */
-typedef struct {
+struct IndexCursor {
   // PageId of the index entry
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
-} IndexCursor;
+
+  // the leaf node held by the cursor, and its PageId (-1 if none).
+  // the leaf is read again if pid is changed to another leaf.
+  BTLeafNode leaf;
+  PageId  leafPid;
+
+  IndexCursor() : pid(-1), eid(0), leafPid(-1) {}
+};
+
+/**
+ * A (key, RecordId) pair stored in a b+tree leaf node.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} IndexEntry;
 
 /**
  * Implements a B-Tree index for bruinbase.
@@ -33,6 +53,9 @@ typedef struct {
  */
 class BTreeIndex {
  public:
+  // the default fill factor of the nodes built by bulk loading
+  static const int DEFAULT_FILL_PERCENT = 100;
+
   BTreeIndex();
 
   /**
@@ -58,9 +81,33 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
-  RC insertHelper(int key, const RecordId& rid, PageId pid, int height, int& ofKey, PageId& ofPid);
+  /**
+   * Start building an empty index bottom-up.
+   * Instead of inserting the pairs one by one into the tree, the pairs
+   * given to bulkInsert() are sorted (spilling sorted runs to temporary
+   * files when they do not fit in memory) and endBulkLoad() writes the
+   * leaf nodes in one sequential pass, followed by the nonleaf levels.
+   * @param fillPercent[IN] how full to pack the nodes, in percent
+   * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index
+   * is not empty, in which case the pairs must be inserted by insert()
+   */
+  RC beginBulkLoad(int fillPercent = DEFAULT_FILL_PERCENT);
+
+  /**
+   * Add a (key, RecordId) pair to the index being bulk loaded.
+   * The pairs may be given in any order.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * Build the tree from the pairs given to bulkInsert().
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
 
-  RC insertHelp(int key, const RecordId& rid, bool& overflow, int height, PageId pid, PageId& siblingPid, int& siblingKey);
   /**
    * Find the leaf-node index entry whose key value is larger than or
    * equal to searchKey and output its location (i.e., the page id of the node
@@ -86,23 +133,61 @@ class BTreeIndex {
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
+   * When the cursor enters a leaf, the next leaf is read ahead in the
+   * background, so a range scan does not wait for the disk at every leaf.
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Count the index entries whose key is in [lo, hi].
+   * The entry counts stored in the nonleaf nodes are summed along the
+   * paths to lo and hi, so only those two paths of the tree are read.
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param count[OUT] the number of entries with lo <= key <= hi
+   * @return error code. 0 if no error
+   */
+  RC countRange(int lo, int hi, int& count);
+
+  /**
+   * Return the height of the tree.
+   * @return 0 if the tree is empty, 1 if the root is a leaf node
+   */
+  int getTreeHeight() const { return treeHeight; }
+
+  /**
+   * Return the number of pages in the index file.
+   * @return the number of pages, including the header page
+   */
+  PageId getPageCount() const { return pf.endPid(); }
   
  private:
+  RC insertHelper(int key, const RecordId& rid, PageId pid, int height,
+                  int& count, int& ofKey, PageId& ofPid, int& ofCount);
+  RC countSmaller(int searchKey, int& count);
+  RC readLeaf(IndexCursor& cursor, PageId pid);
+  RC spillBulkRun();
+  void discardBulkRuns();
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
-  char buffer[PageFile::PAGE_SIZE];
+  bool     writable;   /// whether the index was opened in 'w' mode
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+
+  bool     bulkLoading;    /// whether beginBulkLoad() was called
+  int      bulkFill;       /// the fill factor of bulk loaded nodes
+  long long bulkCount;     /// # of pairs given to bulkInsert()
+  std::vector<IndexEntry> bulkEntries; /// the pairs not spilled yet
+  std::vector<FILE*>     bulkRuns;     /// the sorted runs spilled to disk
 };
 
 #endif /* BTREEINDEX_H */
@@ -1,19 +1,305 @@
 #include "BTreeNode.h"
-#include <iostream>
+#include <climits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SIMD_KERNELS
+#endif
 
 using namespace std;
 
+//
+// The layout of the node pages.
+//
+// Every node page starts with a NodeHeader, followed by the sorted keys
+// of the node in one contiguous array and then the payload array: the
+// RecordIds of a leaf node, or the child PageIds of a nonleaf node. A
+// nonleaf node also stores the number of index entries under each child,
+// so that the entries in a key range are counted without reading the
+// leaves. The arrays are sized for a full node, so their positions
+// depend only on the page size. The header records the format version
+// and the node type, so that a page of another format or type is
+// detected by read().
+//
+static const unsigned short NODE_FORMAT = 3;   // version 2 had no child entry counts
+static const unsigned short LEAF_NODE = 1;
+static const unsigned short NONLEAF_NODE = 2;
+
+struct NodeHeader {
+  unsigned short format;    // NODE_FORMAT
+  unsigned short type;      // LEAF_NODE or NONLEAF_NODE
+  int            keyCount;  // # of keys in the node
+  PageId         next;      // the next leaf node, or -1. unused in a nonleaf node
+  int            reserved;  // pads the header to 16 bytes
+};
+
+static inline const NodeHeader* nodeHeader(const char* page)
+{
+  return (const NodeHeader*) page;
+}
+
+static inline const int* nodeKeys(const char* page)
+{
+  return (const int*) (page + sizeof(NodeHeader));
+}
+
+// a leaf node holds up to leafCapacity() keys and as many RecordIds
+static inline int leafCapacity(int pageSize)
+{
+  return (pageSize - sizeof(NodeHeader)) / (sizeof(int) + sizeof(RecordId));
+}
+
+static inline const RecordId* leafRids(const char* page, int pageSize)
+{
+  return (const RecordId*) (nodeKeys(page) + leafCapacity(pageSize));
+}
+
+// a nonleaf node holds up to nonLeafCapacity() keys and one more PageId
+// and entry count
+static inline int nonLeafCapacity(int pageSize)
+{
+  return (pageSize - sizeof(NodeHeader) - sizeof(PageId) - sizeof(int)) /
+         (sizeof(int) + sizeof(PageId) + sizeof(int));
+}
+
+static inline const PageId* nonLeafChildren(const char* page, int pageSize)
+{
+  return (const PageId*) (nodeKeys(page) + nonLeafCapacity(pageSize));
+}
+
+// the number of index entries under each child
+static inline const int* nonLeafCounts(const char* page, int pageSize)
+{
+  return (const int*) (nonLeafChildren(page, pageSize) + nonLeafCapacity(pageSize) + 1);
+}
+
+/*
+ * Return the number of keys smaller than searchKey, i.e., the position
+ * of the first key >= searchKey.
+ * The range is halved without a data-dependent branch, so that the
+ * search does not stall on mispredicted comparisons; the compiler turns
+ * the selection into a conditional move.
+ */
+static int countSmallerScalar(const int* keys, int count, int searchKey)
+{
+  const int* base = keys;
+
+  if (count == 0) return 0;
+  while (count > 1) {
+    int half = count / 2;
+    base = (base[half] < searchKey) ? base + half : base;
+    count -= half;
+  }
+  return (base - keys) + (*base < searchKey);
+}
+
+#ifdef HAVE_SIMD_KERNELS
+//
+// The SIMD kernels narrow the range with the branch-free binary search
+// until it fits in SIMD_WINDOW keys (two cache lines), and then compare
+// every key in the window with the broadcast search key. Since the keys
+// are sorted, the number of keys that compare smaller is the position of
+// the first key >= searchKey. The last partial vector is read with a
+// masked load, so that no key past the window is touched.
+//
+static const int SIMD_WINDOW = 32;
+
+// narrow [keys, keys + count) to at most SIMD_WINDOW keys that contain the answer
+static inline const int* narrowToWindow(const int* base, int& count, int searchKey)
+{
+  while (count > SIMD_WINDOW) {
+    int half = count / 2;
+    base = (base[half] < searchKey) ? base + half : base;
+    count -= half;
+  }
+  return base;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countSmallerAVX2(const int* keys, int count, int searchKey)
+{
+  const int* base = narrowToWindow(keys, count, searchKey);
+  const __m256i key = _mm256_set1_epi32(searchKey);
+  int smaller = 0;
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (base + i));
+    __m256i lt = _mm256_cmpgt_epi32(key, v);
+    smaller += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+  if (i < count) {
+    // lane j is loaded only if i + j < count
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lanes);
+    __m256i v = _mm256_maskload_epi32(base + i, mask);
+    __m256i lt = _mm256_and_si256(_mm256_cmpgt_epi32(key, v), mask);
+    smaller += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+  return (base - keys) + smaller;
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int countSmallerAVX512(const int* keys, int count, int searchKey)
+{
+  const int* base = narrowToWindow(keys, count, searchKey);
+  const __m512i key = _mm512_set1_epi32(searchKey);
+  int smaller = 0;
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m512i v = _mm512_loadu_si512((const void*) (base + i));
+    smaller += __builtin_popcount(_mm512_cmplt_epi32_mask(v, key));
+  }
+  if (i < count) {
+    __mmask16 mask = (__mmask16) ((1u << (count - i)) - 1);
+    __m512i v = _mm512_maskz_loadu_epi32(mask, base + i);
+    smaller += __builtin_popcount(_mm512_mask_cmplt_epi32_mask(mask, v, key));
+  }
+  return (base - keys) + smaller;
+}
+#endif
+
+typedef int (*SearchKernel)(const int* keys, int count, int searchKey);
+
+bool BTKeySearch::isSupported(int kernel)
+{
+  switch (kernel) {
+  case SCALAR:
+    return true;
+#ifdef HAVE_SIMD_KERNELS
+  case AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  case AVX512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt");
+#endif
+  default:
+    return false;
+  }
+}
+
+const char* BTKeySearch::getName(int kernel)
+{
+  switch (kernel) {
+  case SCALAR: return "scalar";
+  case AVX2:   return "avx2";
+  case AVX512: return "avx512";
+  default:     return "unknown";
+  }
+}
+
+static SearchKernel kernelFunction(int kernel)
+{
+  switch (kernel) {
+#ifdef HAVE_SIMD_KERNELS
+  case BTKeySearch::AVX2:   return countSmallerAVX2;
+  case BTKeySearch::AVX512: return countSmallerAVX512;
+#endif
+  default:                  return countSmallerScalar;
+  }
+}
+
+// the fastest kernel that the CPU supports
+static int bestKernel()
+{
+  if (BTKeySearch::isSupported(BTKeySearch::AVX512)) return BTKeySearch::AVX512;
+  if (BTKeySearch::isSupported(BTKeySearch::AVX2)) return BTKeySearch::AVX2;
+  return BTKeySearch::SCALAR;
+}
+
+// the nodes start with the scalar kernel, until bestKernel() is run at startup
+static int currentKernel = BTKeySearch::SCALAR;
+static SearchKernel countSmaller = countSmallerScalar;
+static const RC kernelChosen = BTKeySearch::setKernel(bestKernel());
+
+RC BTKeySearch::setKernel(int kernel)
+{
+  if (!isSupported(kernel)) return RC_INVALID_ATTRIBUTE;
+  currentKernel = kernel;
+  countSmaller = kernelFunction(kernel);
+  return 0;
+}
+
+int BTKeySearch::getKernel()
+{
+  return currentKernel;
+}
+
+// the position at which key is inserted. equal keys stay in insertion order
+static inline int insertPosition(const int* keys, int count, int key)
+{
+  if (key == INT_MAX) return count;
+  return countSmaller(keys, count, key + 1);
+}
+
+//
+// The empty leaf and nonleaf nodes that new nodes read until they are
+// modified, so that a node that is only used to read() a page never
+// allocates its buffer. They are large enough for any page size.
+//
+struct EmptyNodes {
+  char pages[2][PageFile::MAX_PAGE_SIZE];
+
+  EmptyNodes() {
+    memset(pages, 0, sizeof(pages));
+    for (int i = 0; i < 2; i++) {
+      NodeHeader* header = (NodeHeader*) pages[i];
+      header->format = NODE_FORMAT;
+      header->type = (i == 0) ? LEAF_NODE : NONLEAF_NODE;
+      header->keyCount = 0;
+      header->next = -1;
+    }
+  }
+};
+
+static const char* emptyNode(unsigned short type)
+{
+  static const EmptyNodes nodes;
+  return nodes.pages[type == LEAF_NODE ? 0 : 1];
+}
+
+BTLeafNode::BTLeafNode(int size)
+{
+  pageSize = size;
+  data = emptyNode(LEAF_NODE);
+}
+
 /*
- * Returns a pointer to the BTLeafNode's buffer 
+ * Returns a pointer to the BTLeafNode's buffer
  */
 char* BTLeafNode::getBuffer()
 {
-  return buffer;
+  materialize();
+  return buffer.data();
 }
 
-int BTLeafNode::getBufferIndex()
+/*
+ * Copy the pinned page into the node's buffer before it is modified
+ */
+void BTLeafNode::materialize()
 {
-  return buffer_index;
+  if (data != buffer.data()) {
+    buffer.resize(pageSize);
+    memcpy(buffer.data(), data, pageSize);
+    data = buffer.data();
+    page.release();
+  }
+}
+
+/*
+ * Make the node an empty leaf node
+ */
+void BTLeafNode::initialize()
+{
+  materialize();
+  memset(buffer.data(), 0, pageSize);
+
+  NodeHeader* header = (NodeHeader*) buffer.data();
+  header->format = NODE_FORMAT;
+  header->type = LEAF_NODE;
+  header->keyCount = 0;
+  header->next = -1;
 }
 
 /*
@@ -23,24 +309,21 @@ int BTLeafNode::getBufferIndex()
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
-{ 
-  // cout << "BTLeafNode :: read -- in read function" << endl;
-  pf.read(pid, buffer);
-  for (int i = 0; i < PageFile::PAGE_SIZE; ++i)
-  {
-    if (buffer[i] != -1)
-    {
-      buffer_index++;
-      // cout << "BTLeafNode :: read -- buffer_index: " << buffer_index << endl;
-    }
-    else {
-      keyCount = buffer_index / 12;
-      printf("buffer: %s", buffer);
-      return 0;
-    }
-  }
+{
+  RC rc;
+  if ((rc = page.pin(pf, pid)) < 0)
+    return rc;
+  data = page.data();
+  pageSize = pf.getPageSize();
+
+  // make sure that the page holds a leaf node of the current format
+  const NodeHeader* header = nodeHeader(data);
+  if (header->format != NODE_FORMAT || header->type != LEAF_NODE ||
+      header->keyCount < 0 || header->keyCount > getMaxKeyCount())
+    return RC_INVALID_FILE_FORMAT;
+  return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -48,8 +331,8 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
-{ 
-  return pf.write(pid, buffer);
+{
+  return pf.write(pid, data);
 }
 
 /*
@@ -57,8 +340,23 @@ RC BTLeafNode::write(PageId pid, PageFile& pf)
  * @return the number of keys in the node
  */
 int BTLeafNode::getKeyCount()
-{ 
-  return keyCount;
+{
+  return nodeHeader(data)->keyCount;
+}
+
+/*
+ * Return the maximum number of keys that fit in the node.
+ * @return the capacity of the node
+ */
+int BTLeafNode::getMaxKeyCount()
+{
+  return leafCapacity(pageSize);
+}
+
+void BTLeafNode::setKeyCount(int count)
+{
+  materialize();
+  ((NodeHeader*) buffer.data())->keyCount = count;
 }
 
 /*
@@ -68,58 +366,22 @@ int BTLeafNode::getKeyCount()
  * @return 0 if successful. Return an error code if the node is full.
  */
 RC BTLeafNode::insert(int key, const RecordId& rid)
-{ 
-  cout << "BTLeafNode :: insert -- key: " << key << endl;
-  int potentiallyUsedBuffer = buffer_index + sizeof(int) + sizeof(RecordId);
-  if(potentiallyUsedBuffer < PageFile::PAGE_SIZE){
-    if (buffer_index == 0) //when buffer is empty
-    {
-      cout << "BTLeafNode :: insert -- in if block cus buffer_index == 0" << endl << endl;
-      insertKey(key, 0);
-      insertRid(rid, sizeof(int));
-
-    }
-    else {
-      // for (int i = sizeof(RecordId); i < buffer_index; i = i + sizeof(RecordId) + sizeof(int)) // when buffer isn't empty
-      // {
-      //   if (key <= buffer[i])
-      //   {
-      //     insertIndex = i;
-      //     memcpy ((char*)(buffer + insertIndex + sizeof(RecordId) + sizeof(int)), (buffer + insertIndex), potentiallyUsedBuffer-insertIndex+1);
-      //     insertKey(key, insertIndex);
-      //     insertRid(rid, insertIndex + sizeof(int));
-      //     break;
-      //   }
-      //   else {
-      //     insertKey(key, buffer_index);
-      //     insertRid(rid, buffer_index + sizeof(int));
-
-      //   }
-      // }
-      int eid = -1;
-      locate (key, eid);
-      if (eid == -1)
-      {
-        insertKey(key, buffer_index);
-        insertRid(rid, buffer_index + sizeof(int));
-      }
-      else {
-        cout << "BTLeafNode :: insert -- in else statment / about to move buffer" << endl;
-        insertIndex = eid * 12;
-        memcpy ((char*)(buffer + insertIndex + sizeof(RecordId) + sizeof(int)), &(buffer[insertIndex]), potentiallyUsedBuffer-insertIndex);
-        insertKey(key, insertIndex);
-        insertRid(rid, insertIndex + sizeof(int));
-        cout << "BTLeafNode :: insert -- buffer_index: " << buffer_index << endl;
-      }
-    }
-    keyCount++;
-    buffer_index = buffer_index + sizeof(int) + sizeof(RecordId);
-    // cout << "BTLeafNode :: insert -- keyCount: " << getKeyCount() << endl;
-    cout << "BTLeafNode :: insert -- buffer_index: " << buffer_index << endl;
-      return 0;
-  }
-  else
-    return RC_NODE_FULL; // ERROR
+{
+  int count = getKeyCount();
+  if (count >= getMaxKeyCount())
+    return RC_NODE_FULL;
+
+  materialize();
+  int* keys = (int*) nodeKeys(buffer.data());
+  RecordId* rids = (RecordId*) leafRids(buffer.data(), pageSize);
+  int eid = insertPosition(keys, count, key);
+
+  memmove(keys + eid + 1, keys + eid, (count - eid) * sizeof(int));
+  memmove(rids + eid + 1, rids + eid, (count - eid) * sizeof(RecordId));
+  keys[eid] = key;
+  rids[eid] = rid;
+  setKeyCount(count + 1);
+  return 0;
 }
 
 /*
@@ -132,60 +394,38 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param siblingKey[OUT] the first key in the sibling node after split.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
+RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                               BTLeafNode& sibling, int& siblingKey)
 {
-  cout << "BTLeafNode :: insertAndSplit called" <<endl;
-  if (insert(key, rid) == 0 && split(sibling, siblingKey)) //if insert succeeds, then just split node
-  {
-      return 0;
-  }
-  else { //if insert fails due to lack of space, split then insert
-    for (int i = sizeof(RecordId); i < buffer_index; i = i + sizeof(RecordId) + sizeof(int)) {
-      if (key <= buffer[i]) //PROBLEM: comparing int to one char? do we need to include length?
-      {
-        insertIndex = i; //where to insert
-      }
-    }
-    int halfKeyCount = (int)floor(keyCount/2);
-    int splitIndex = sizeof(RecordId) * halfKeyCount + sizeof(int) * halfKeyCount;
-
-    split(sibling, siblingKey);
-    if (insertIndex <= splitIndex) //insert into original node after split
-    {
-      insert(key, rid);
-      return 0;
-    }
-    else if (insertIndex > splitIndex) { //insert into new node
-      sibling.insert(key, rid);
-      return 0;
-    }
-    else {
-      return 1; //ERROR
-    }
-  }
-}
+  if (sibling.getKeyCount() != 0)
+    return RC_NODE_FULL;  // the sibling must be empty
+
+  materialize();
+  sibling.materialize();
+  int count = getKeyCount();
+  int* keys = (int*) nodeKeys(buffer.data());
+  RecordId* rids = (RecordId*) leafRids(buffer.data(), pageSize);
+  int* siblingKeys = (int*) nodeKeys(sibling.buffer.data());
+  RecordId* siblingRids = (RecordId*) leafRids(sibling.buffer.data(), sibling.pageSize);
+
+  // the first half of the count+1 keys stays here, the rest moves to the
+  // sibling. the new key is then inserted into the node it belongs to.
+  int half = (count + 2) / 2;
+  int eid = insertPosition(keys, count, key);
+  int moved = (eid < half) ? half - 1 : half;
+
+  memcpy(siblingKeys, keys + moved, (count - moved) * sizeof(int));
+  memcpy(siblingRids, rids + moved, (count - moved) * sizeof(RecordId));
+  sibling.setKeyCount(count - moved);
+  setKeyCount(moved);
+
+  if (eid < half)
+    insert(key, rid);
+  else
+    sibling.insert(key, rid);
 
-bool BTLeafNode::split (BTLeafNode& sibling, int& siblingKey) {
-  if (sibling.buffer_index != 0)
-  {
-    return false; //ERROR: sibling node is not empty
-  }
-  else {
-    int halfKeyCount = (int)floor(keyCount/2);
-    int splitIndex = sizeof(RecordId) * halfKeyCount + sizeof(int) * halfKeyCount;
-    
-    memcpy ((char*)sibling.buffer, (buffer + splitIndex), buffer_index - splitIndex);
-    //set sibling's buffer_index
-    sibling.buffer_index = buffer_index - splitIndex;
-    // PageId siblingPid = sibling.buffer[0]; //WRONG: sibling.buffer[0] is a key, not a PageId
-    PageId siblingPid = *(PageId *)(sibling.buffer + sizeof(int));
-    insertPid(siblingPid, splitIndex);
-    // buffer_index += sizeof(PageId);
-    buffer_index = splitIndex + sizeof(PageId); 
-    siblingKey = *(int *)(sibling.buffer);
-    return true;
-  }
+  siblingKey = siblingKeys[0];
+  return 0;
 }
 
 /*
@@ -198,30 +438,10 @@ bool BTLeafNode::split (BTLeafNode& sibling, int& siblingKey) {
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-  eid = 0;
-  cout << "BTLeafNode:: locate -- buffer_index: " << buffer_index <<endl;
-  for (int i = 0; i < buffer_index-sizeof(RecordId); i = i + sizeof(RecordId) + sizeof(int))
-  {
-    cout << "BTLeafNode :: locate -- value check: " << *((int *) (buffer + i)) << endl;
-    cout << "BTLeafNode :: locate -- searchKey: " << searchKey << endl;
-    if (searchKey > *((int *) (buffer + i)))
-    {
-      cout << "BTLeafNode :: locate -- IN IF BLOCK" <<endl;
-      eid++;
-    }
-    else {
-      break;
-    }
-  }
-  cout << "BTLeafNode :: locate -- eid: " << eid <<endl;
-  cout << "BTLeafNode :: locate -- keyCount: " << keyCount <<endl;
-  if (eid == getKeyCount())
-  {
-    cout << "BTLeafNode :: locate -- didn't find eid" << endl;
-    eid = -1;
-    return RC_NO_SUCH_RECORD;
-  }
-  return 0;
+  int count = getKeyCount();
+
+  eid = countSmaller(nodeKeys(data), count, searchKey);
+  return (eid < count) ? 0 : RC_NO_SUCH_RECORD;
 }
 
 /*
@@ -233,120 +453,91 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  */
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 {
-  // cout << "buffer index: " << buffer_index <<endl;
-  // cout<<"EID: " <<eid<<endl<<endl;
-  if (buffer_index == 0)
-  {
+  if (eid < 0 || eid >= getKeyCount())
     return RC_NO_SUCH_RECORD;
-  }
 
-  else if (eid <= getKeyCount())
-  {
-    // cout<< "EID IN IF: " << eid << endl << "check cond: "<< 0-4-8 << endl;
-    key = *((int *) (buffer + eid));
-    rid.pid = *((PageId *) (buffer + eid+sizeof(int))); //struct rid = pid and sid WHICH ONE FIRST?????
-    rid.sid = *((int *) (buffer + eid + sizeof(PageId) + sizeof(int)));
-    return 0;
-  }
-  
-    return RC_NO_SUCH_RECORD; //eid doesn't exist in buffer
-  
+  key = nodeKeys(data)[eid];
+  rid = leafRids(data, pageSize)[eid];
+  return 0;
 }
 
 /*
  * Return the pid of the next slibling node.
- * @return the PageId of the next sibling node 
+ * @return the PageId of the next sibling node
  */
 PageId BTLeafNode::getNextNodePtr()
 {
-  return *((PageId *)(buffer + buffer_index-sizeof(PageId)));
+  return nodeHeader(data)->next;
 }
 
 /*
  * Set the pid of the next slibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * @param pid[IN] the PageId of the next sibling node
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
 {
-  memcpy((char*)(buffer + buffer_index-sizeof(PageId)), &pid, sizeof(PageId));
+  materialize();
+  ((NodeHeader*) buffer.data())->next = pid;
   return 0;
 }
 
-/* 
- * Inserts a key into the buffer
- * Returns True if inserts correctly
- * Returns False if node is full
+/*
+ * Read the content of the node from the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
  */
-bool BTLeafNode::insertKey(int key, int insertIndex){
-    if(buffer_index + sizeof(int) >= PageFile::PAGE_SIZE) {
-      // cout << "BTLeafNode :: insertKey -- buffer_index: " << buffer_index << endl;
-      // cout << "BTLeafNode :: insertKey -- about to return false" << endl;
-      return false;
-    }
-    memcpy((char*) (buffer + insertIndex), &key, sizeof(int));
-    cout << "BTLeafNode :: insertKey: " << key << endl;
-    cout << "BTLeafNode :: insertKey -- insertIndex: " << insertIndex << endl;
-    // buffer_index = buffer_index + sizeof(int);
-    // keyCount++;
-    // cout << "BTLeafNode :: insertKey -- buffer_index: " << buffer_index << endl;
-    // cout << "BTLeafNode :: insertKey -- keyCount: " << getKeyCount() << endl;
-    return true;
+RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
+{
+  RC rc;
+  if ((rc = page.pin(pf, pid)) < 0)
+    return rc;
+  data = page.data();
+  pageSize = pf.getPageSize();
+
+  // make sure that the page holds a nonleaf node of the current format
+  const NodeHeader* header = nodeHeader(data);
+  if (header->format != NODE_FORMAT || header->type != NONLEAF_NODE ||
+      header->keyCount < 0 || header->keyCount > getMaxKeyCount())
+    return RC_INVALID_FILE_FORMAT;
+  return 0;
 }
 
-/* 
- * Inserts a PageId into the buffer
- * Returns True if inserts correctly
- * Returns False if node is full
- */
-bool BTLeafNode::insertPid(PageId pid, int insertIndex){
-  if(buffer_index + sizeof(PageId) >= PageFile::PAGE_SIZE)
-      return false;
-  memcpy((char*)(buffer + insertIndex), &pid, sizeof(PageId));
-  // buffer_index = buffer_index + sizeof(PageId);
-  return true;
-}
-
-/* 
- * Inserts a RId into the buffer
- * Returns True if inserts correctly
- * Returns False if node is full
- */
-bool BTLeafNode::insertRid(const RecordId& rid, int insertIndex)
+BTNonLeafNode::BTNonLeafNode(int size)
 {
-  if(buffer_index + sizeof(PageId) + sizeof(int) >= PageFile::PAGE_SIZE)
-      return false;
-  memcpy((char*)(buffer + insertIndex), &rid.pid, sizeof(PageId));
-  // buffer_index = buffer_index + sizeof(PageId);
-  memcpy((char*)(buffer + insertIndex + sizeof(PageId)), &rid.sid, sizeof(int));
-  // buffer_index = buffer_index + sizeof(int);
-  return true;
+  pageSize = size;
+  data = emptyNode(NONLEAF_NODE);
 }
 
 /*
- * Read the content of the node from the page pid in the PageFile pf.
- * @param pid[IN] the PageId to read
- * @param pf[IN] PageFile to read from
- * @return 0 if successful. Return an error code if there is an error.
+ * Copy the pinned page into the node's buffer before it is modified
  */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
-{ 
-  // cout << "BTNonLeafNode :: read -- in read function" << endl;
-  pf.read(pid, buffer);
-  for (int i = 0; i < PageFile::PAGE_SIZE; ++i)
-  {
-    if (buffer[i] != -1)
-    {
-      buffer_index++;
-    }
-    else {
-      keyCount = buffer_index/8;
-      printf("buffer: %s", buffer);
-      return 0;
-    }
+void BTNonLeafNode::materialize()
+{
+  if (data != buffer.data()) {
+    buffer.resize(pageSize);
+    memcpy(buffer.data(), data, pageSize);
+    data = buffer.data();
+    page.release();
   }
 }
-    
+
+/*
+ * Make the node an empty nonleaf node
+ */
+void BTNonLeafNode::initialize()
+{
+  materialize();
+  memset(buffer.data(), 0, pageSize);
+
+  NodeHeader* header = (NodeHeader*) buffer.data();
+  header->format = NODE_FORMAT;
+  header->type = NONLEAF_NODE;
+  header->keyCount = 0;
+  header->next = -1;
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -354,12 +545,8 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
-{ 
-  // if(!pf.write(pid, buffer))
-  //   return 0;
-  // else
-  //   return RC_FILE_WRITE_FAILED;
-    return pf.write(pid, buffer);
+{
+  return pf.write(pid, data);
 }
 
 /*
@@ -367,44 +554,74 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf)
  * @return the number of keys in the node
  */
 int BTNonLeafNode::getKeyCount()
-{ 
-  return keyCount; 
+{
+  return nodeHeader(data)->keyCount;
+}
+
+/*
+ * Return the maximum number of keys that fit in the node.
+ * @return the capacity of the node
+ */
+int BTNonLeafNode::getMaxKeyCount()
+{
+  return nonLeafCapacity(pageSize);
 }
 
+void BTNonLeafNode::setKeyCount(int count)
+{
+  materialize();
+  ((NodeHeader*) buffer.data())->keyCount = count;
+}
+
+/*
+ * Return the position of a new key in the node. The child of the key
+ * goes right after the child left if left is among the children around
+ * the keys equal to key, and after the equal keys otherwise.
+ */
+int BTNonLeafNode::insertIndex(int key, PageId left)
+{
+  const int* keys = nodeKeys(data);
+  const PageId* children = nonLeafChildren(data, pageSize);
+  int count = getKeyCount();
+  int end = insertPosition(keys, count, key);
+
+  if (left >= 0) {
+    // the children from the first key equal to key up to the last one
+    for (int i = countSmaller(keys, count, key); i <= end; i++)
+      if (children[i] == left) return i;
+  }
+  return end;
+}
 
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param left[IN] the child that pid was split from, or -1
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
-{ 
-  int potentiallyUsedBuffer = buffer_index + sizeof(int) + sizeof(PageId);
-  if(potentiallyUsedBuffer < PageFile::PAGE_SIZE){
-    for (int i = sizeof(PageId); i < buffer_index; i = i + sizeof(PageId) + sizeof(int))
-    {
-      if (key <= buffer[i]) //PROBLEM: comparing int to one char? do we need to include length?
-      {
-        insertIndex = i;
-        memcpy ((char*)buffer[insertIndex + sizeof(PageId) + sizeof(int)], &buffer[insertIndex], potentiallyUsedBuffer-insertIndex+1);
-        insertKey(key, insertIndex);
-        insertPid(pid, insertIndex + sizeof(int));
-//        return 0;
-      }
-      else { //insert at the end because it's bigger than everything else
-        insertKey(key, buffer_index);
-        insertPid(pid, buffer_index + sizeof(int));
-//        return 0;
-      }
-    }
-    buffer_index = buffer_index + sizeof(PageId) + sizeof(int);
-    keyCount++;
-    return 0;
-  }
-  else
-    return RC_NODE_FULL; // ERROR
-  
+RC BTNonLeafNode::insert(int key, PageId pid, PageId left)
+{
+  int count = getKeyCount();
+  if (count >= getMaxKeyCount())
+    return RC_NODE_FULL;
+
+  materialize();
+  int* keys = (int*) nodeKeys(buffer.data());
+  PageId* children = (PageId*) nonLeafChildren(buffer.data(), pageSize);
+  int* counts = (int*) nonLeafCounts(buffer.data(), pageSize);
+  int i = insertIndex(key, left);
+
+  // pid becomes the child after the new key. its entry count is set
+  // later by setChildCount()
+  memmove(keys + i + 1, keys + i, (count - i) * sizeof(int));
+  memmove(children + i + 2, children + i + 1, (count - i) * sizeof(PageId));
+  memmove(counts + i + 2, counts + i + 1, (count - i) * sizeof(int));
+  keys[i] = key;
+  children[i + 1] = pid;
+  counts[i + 1] = 0;
+  setKeyCount(count + 1);
+  return 0;
 }
 
 /*
@@ -415,125 +632,142 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  * @param pid[IN] the PageId to insert
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @param left[IN] the child that pid was split from, or -1
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
-{ 
-  if (insert(key, pid) == 0 && split(sibling, midKey)) //if insert succeeds, then just split node
-  {
-      return 0;
-  }
-  else { //if insert fails due to lack of space, split then insert
-    for (int i = sizeof(PageId); i < buffer_index; i = i + sizeof(PageId) + sizeof(int)) {
-      if (key <= buffer[i]) //PROBLEM: comparing int to one char? do we need to include length?
-      {
-        insertIndex = i; //where to insert
-      }
-    }
-    int halfKeyCount = (int)floor(keyCount/2);
-    int splitIndex = sizeof(PageId) * halfKeyCount + sizeof(int) * halfKeyCount;
-
-    split(sibling, midKey);
-    if (insertIndex <= splitIndex) //insert into original node after split
-    {
-      insert(key, pid);
-      return 0;
-    }
-    else if (insertIndex > splitIndex) { //insert into new node
-      sibling.insert(key, pid);
-      return 0;
-    }
-    else {
-      return 1; //ERROR
-    }
-  }
-}
-
-bool BTNonLeafNode::split(BTNonLeafNode& sibling, int& midKey)
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, PageId left)
 {
-    if (sibling.buffer_index != 0)
-    {
-      return false; //ERROR: sibling node is not empty
-    }
-    else {
-      int halfKeyCount = (int)floor(keyCount/2);
-      int splitIndex = sizeof(PageId) * halfKeyCount + sizeof(int) * halfKeyCount;
-      
-      memcpy ((char*)sibling.buffer, (buffer + splitIndex), buffer_index - splitIndex + 1);
-      //set sibling's buffer_index
-      sibling.buffer_index = buffer_index - splitIndex;
-      buffer_index = splitIndex + sizeof(PageId); 
-      memcpy((int*)&midKey, (sibling.buffer + sizeof(PageId)), sizeof(PageId));
-      //midKey = sibling.buffer[ sizeof(PageId) ];
-      return true;
-    }
+  if (sibling.getKeyCount() != 0)
+    return RC_NODE_FULL;  // the sibling must be empty
+
+  materialize();
+  sibling.materialize();
+  int count = getKeyCount();
+  int* keys = (int*) nodeKeys(buffer.data());
+  PageId* children = (PageId*) nonLeafChildren(buffer.data(), pageSize);
+  int* counts = (int*) nonLeafCounts(buffer.data(), pageSize);
+
+  // lay out all count+1 keys and count+2 children in sorted order.
+  // the arrays are on the heap: inserts recurse, and may run on threads
+  // with small stacks
+  vector<int> allKeys(count + 1);
+  vector<PageId> allChildren(count + 2);
+  vector<int> allCounts(count + 2);
+  int i = insertIndex(key, left);
+
+  memcpy(allKeys.data(), keys, i * sizeof(int));
+  allKeys[i] = key;
+  memcpy(allKeys.data() + i + 1, keys + i, (count - i) * sizeof(int));
+  memcpy(allChildren.data(), children, (i + 1) * sizeof(PageId));
+  allChildren[i + 1] = pid;
+  memcpy(allChildren.data() + i + 2, children + i + 1, (count - i) * sizeof(PageId));
+  memcpy(allCounts.data(), counts, (i + 1) * sizeof(int));
+  allCounts[i + 1] = 0;
+  memcpy(allCounts.data() + i + 2, counts + i + 1, (count - i) * sizeof(int));
+
+  // the keys before the middle one stay here. the middle key moves up to
+  // the parent, and the keys after it move to the sibling.
+  int mid = (count + 1) / 2;
+  memcpy(keys, allKeys.data(), mid * sizeof(int));
+  memcpy(children, allChildren.data(), (mid + 1) * sizeof(PageId));
+  memcpy(counts, allCounts.data(), (mid + 1) * sizeof(int));
+  setKeyCount(mid);
+
+  memcpy((int*) nodeKeys(sibling.buffer.data()), allKeys.data() + mid + 1, (count - mid) * sizeof(int));
+  memcpy((PageId*) nonLeafChildren(sibling.buffer.data(), sibling.pageSize), allChildren.data() + mid + 1,
+         (count - mid + 1) * sizeof(PageId));
+  memcpy((int*) nonLeafCounts(sibling.buffer.data(), sibling.pageSize), allCounts.data() + mid + 1,
+         (count - mid + 1) * sizeof(int));
+  sibling.setKeyCount(count - mid);
+
+  midKey = allKeys[mid];
+  return 0;
 }
 
 /*
  * Given the searchKey, find the child-node pointer to follow and
  * output it in pid.
+ * A child whose keys are all equal to searchKey may be preceded by
+ * another child that also ends with searchKey, so the search follows
+ * the child before the first key that is >= searchKey.
  * @param searchKey[IN] the searchKey that is being looked up.
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 {
-  int key_index = sizeof(PageId); // index is at the first key in the node
-  while((int) buffer[key_index] != searchKey) 
-  {
-    key_index += sizeof(int) + sizeof(PageId);
-    if(key_index >= PageFile::PAGE_SIZE)
-      return RC_NO_SUCH_RECORD; // searchKey not found
-  }
+  int i = countSmaller(nodeKeys(data), getKeyCount(), searchKey);
 
-  // key_index will point to last (key, pid) pair
-  int pid_index = key_index + sizeof(int);
-  pid = buffer[pid_index];
+  pid = nonLeafChildren(data, pageSize)[i];
   return 0;
 }
 
 /*
- * Initialize the root node with (pid1, key, pid2).
- * @param pid1[IN] the first PageId to insert
- * @param key[IN] the key that should be inserted between the two PageIds
- * @param pid2[IN] the PageId to insert behind the key
+ * Given the searchKey, find the child-node pointer to follow, and count
+ * the index entries under the children before it. Since those children
+ * hold only keys smaller than searchKey, summing preceding over the path
+ * to a leaf counts the entries smaller than searchKey.
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param pid[OUT] the pointer to the child node to follow.
+ * @param preceding[OUT] the number of entries under the children before pid.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
-{ 
-  // !insert because insert returns 0 if it returns succesfully
-  if(insertPid(pid1, 0) && insert(key, pid2) == 0){
-    buffer_index = buffer_index + sizeof(PageId);
-    return 0; 
-  }
-  else
-    return 1; // ERROR
+RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid, int& preceding)
+{
+  int i = countSmaller(nodeKeys(data), getKeyCount(), searchKey);
+  const int* counts = nonLeafCounts(data, pageSize);
+
+  preceding = 0;
+  for (int j = 0; j < i; j++) preceding += counts[j];
+  pid = nonLeafChildren(data, pageSize)[i];
+  return 0;
 }
 
-/* 
- * Inserts a key into the buffer
- * Returns True if inserts correctly
- * Returns False if node is full
+/*
+ * Set the number of index entries under the child pid.
+ * The children are searched from the last one, where a node that is
+ * built left to right adds its children.
+ * @param pid[IN] the child node
+ * @param count[IN] the number of (key, rid) pairs under the child
+ * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not a child of the node.
  */
-  bool BTNonLeafNode::insertKey(int key, int insertIndex){
-      if(buffer_index + sizeof(int) >= PageFile::PAGE_SIZE)
-        return false;
-      memcpy((char*) (buffer + insertIndex), &key, sizeof(int));
-      // buffer_index+=sizeof(int);
-      // keyCount++;
-      return true;
+RC BTNonLeafNode::setChildCount(PageId pid, int count)
+{
+  const PageId* children = nonLeafChildren(data, pageSize);
+
+  for (int i = getKeyCount(); i >= 0; i--) {
+    if (children[i] == pid) {
+      materialize();
+      ((int*) nonLeafCounts(buffer.data(), pageSize))[i] = count;
+      return 0;
+    }
   }
+  return RC_NO_SUCH_RECORD;
+}
 
-/* 
- * Inserts a PageId into the buffer
- * Returns True if inserts correctly
- * Returns False if node is full
+/*
+ * Return the number of index entries under the node.
+ * @return the sum of the entry counts of the children
  */
-  bool BTNonLeafNode::insertPid(PageId pid, int insertIndex){
-    if(buffer_index + sizeof(PageId) >= PageFile::PAGE_SIZE)
-        return false;
-    memcpy((char*) (buffer + insertIndex), &pid, sizeof(PageId));
-    // buffer_index+=sizeof(PageId);
-    return true;
-  }
+int BTNonLeafNode::getEntryCount()
+{
+  const int* counts = nonLeafCounts(data, pageSize);
+  int total = 0;
+
+  for (int i = 0; i <= getKeyCount(); i++) total += counts[i];
+  return total;
+}
 
+/*
+ * Initialize the root node with (pid1, key, pid2).
+ * @param pid1[IN] the first PageId to insert
+ * @param key[IN] the key that should be inserted between the two PageIds
+ * @param pid2[IN] the PageId to insert behind the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+{
+  initialize();
+  ((PageId*) nonLeafChildren(buffer.data(), pageSize))[0] = pid1;
+  return insert(key, pid2);
+}
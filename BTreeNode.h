@@ -12,37 +12,69 @@
 
 #include "RecordFile.h"
 #include "PageFile.h"
-#include <cmath>
+#include <cstring>
+#include <vector>
+
+/**
+ * BTKeySearch: The kernels that search the sorted keys of a node.
+ *
+ * Besides the scalar binary search, there are kernels that compare 8
+ * (AVX2) or 16 (AVX-512) keys at a time with the search key. The nodes
+ * use the fastest kernel that the CPU supports, unless another kernel is
+ * chosen with setKernel() (e.g., to compare the kernels in a benchmark).
+ */
+class BTKeySearch {
+  public:
+    static const int SCALAR = 0;
+    static const int AVX2   = 1;
+    static const int AVX512 = 2;
+
+   /**
+    * Choose the kernel that the nodes use to search their keys.
+    * @param kernel[IN] SCALAR, AVX2 or AVX512
+    * @return 0 if successful. RC_INVALID_ATTRIBUTE if the CPU does not
+    *         support the kernel.
+    */
+    static RC setKernel(int kernel);
+
+   /**
+    * @return the kernel that the nodes currently use
+    */
+    static int getKernel();
+
+   /**
+    * @param kernel[IN] SCALAR, AVX2 or AVX512
+    * @return true if the CPU supports the kernel
+    */
+    static bool isSupported(int kernel);
+
+   /**
+    * @param kernel[IN] SCALAR, AVX2 or AVX512
+    * @return the name of the kernel
+    */
+    static const char* getName(int kernel);
+};
 
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
+ *
+ * A leaf node page starts with a node header (the format version, the
+ * node type, the number of keys and the PageId of the next leaf),
+ * followed by the array of the sorted keys and then the array of the
+ * RecordIds of the keys. Keeping the keys together means that a search
+ * reads only the cache lines that hold keys.
  */
 class BTLeafNode {
   public:
 
-    BTLeafNode(){
-        memset(buffer, -1, PageFile::PAGE_SIZE);
-        buffer_index = 0;
-        keyCount = 0;
-    }
-    // BTLeafNode(PageId pid, PageFile pf){
-    //     memset(buffer, 0, PageFile::PAGE_SIZE);
-    //     read(pid, pf);
-    //     while(buffer[buffer_index] != '\0'){
-    //         buffer_index+=12;
-    //         keyCount++;
-    //     }
-    //     buffer_index-= 4; // to return to the end of the pid of the leaf node
-    // }
-
+    // an empty node. size is the page size of the index file
+    BTLeafNode(int size = PageFile::DEFAULT_PAGE_SIZE);
 
     /**
      * Returns a char pointer to buffer of LeafNode
      */
     char* getBuffer();
 
-    int getBufferIndex();
-      
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -65,21 +97,15 @@ class BTLeafNode {
     */
     RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
 
-    /*
-    * split contents of the node with a sibling node
-    * sibling node must be empty
-    * param OUT the midKey
-    */
-    bool split (BTLeafNode& sibling, int& siblingKey);
-
    /**
     * Find the index entry whose key value is larger than or equal to searchKey
     * and output the eid (entry id) whose key value &gt;= searchKey.
     * Remember that keys inside a B+tree node are sorted.
     * @param searchKey[IN] the key to search for.
-    * @param eid[OUT] the entry number that contains a key larger              
-    *                 than or equalty to searchKey.
-    * @return 0 if successful. Return an error code if there is an error.
+    * @param eid[OUT] the entry number that contains a key larger
+    *                 than or equalty to searchKey. If every key in the
+    *                 node is smaller, eid is set to getKeyCount().
+    * @return 0 if successful. RC_NO_SUCH_RECORD if every key is smaller.
     */
     RC locate(int searchKey, int& eid);
 
@@ -94,14 +120,14 @@ class BTLeafNode {
 
    /**
     * Return the pid of the next slibling node.
-    * @return the PageId of the next sibling node 
+    * @return the PageId of the next sibling node. -1 for the last leaf
     */
     PageId getNextNodePtr();
 
 
    /**
     * Set the next slibling node PageId.
-    * @param pid[IN] the PageId of the next sibling node 
+    * @param pid[IN] the PageId of the next sibling node
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC setNextNodePtr(PageId pid);
@@ -111,15 +137,23 @@ class BTLeafNode {
     * @return the number of keys in the node
     */
     int getKeyCount();
- 
+
+   /**
+    * Return the maximum number of keys that fit in the node.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page is pinned in the buffer pool and read in place; it is
+    * copied into the node only when the node is modified.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
-    
+
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -130,75 +164,68 @@ class BTLeafNode {
 
 
   private:
+    int pageSize;  // the page size of the index file. set by read()
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The main memory buffer for loading the content of the disk page
+    * that contains the node. It is allocated with the page size of the
+    * index file when the node is first modified.
     */
-    int buffer_index;
-    int keyCount;
-    int insertIndex;
-    char buffer[PageFile::PAGE_SIZE];
-
-    /* 
-     * Inserts a key into the buffer
-     * Returns True if inserts correctly
-     * Returns False if node is full
+    std::vector<char> buffer;
+
+    /**
+     * The content of the node: either the pinned page in the buffer pool
+     * (after read()), a shared empty node (for a new node) or buffer
+     * (for a modified node).
      */
-    bool insertKey(int key, int insertIndex);
+    const char* data;
+    PinnedPage page;
 
-    /* 
-     * Inserts a RId into the buffer
-     * Returns True if inserts correctly
-     * Returns False if node is full
+    /*
+     * Copy a pinned page into buffer before the node is modified
      */
-     bool insertRid(const RecordId& rid, int insertIndex);
+    void materialize();
 
-    /* 
-     * Inserts a PageId into the buffer
-     * Returns True if inserts correctly
-     * Returns False if node is full
+    /*
+     * Make the node an empty node of the current format
+     */
+    void initialize();
+
+    /*
+     * Update the number of keys stored in the node
      */
-    bool insertPid(PageId pid, int insertIndex);
-}; 
+    void setKeyCount(int count);
+};
 
 
 /**
  * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ *
+ * A nonleaf node page starts with a node header (the format version, the
+ * node type and the number of keys), followed by the array of the sorted
+ * keys, the array of the child PageIds and the array of the number of
+ * index entries under each child. The child i holds the keys between
+ * key i-1 and key i, so there is one more child than keys.
  */
 class BTNonLeafNode {
   public:
 
     // Constructor for BTNonLeafNode
-    // Inits private vars
-    BTNonLeafNode(){
-        memset(buffer, -1, PageFile::PAGE_SIZE);
-        buffer_index = 0;
-        keyCount = 0;
-    }
-
-int getBufferIndex()
-{
-  return buffer_index;
-}
-/*
-    BTNonLeafNode(PageId pid, PageFile pf){
-        memset(buffer, 0, PageFile::PAGE_SIZE);
-        read(pid, pf);
-        while(buffer[buffer_index] != '\0'){
-            buffer_index+=12;
-            keyCount++;
-        }
-        buffer_index-= 4; // to return to the end of the pid of the leaf node
-    }
-*/
+    // Inits private vars. size is the page size of the index file
+    BTNonLeafNode(int size = PageFile::DEFAULT_PAGE_SIZE);
+
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * When pid is the new sibling of a child that was split, the child is
+    * given in left, so that pid is placed right after it even if other
+    * keys are equal to key. Otherwise the pair goes after the equal keys.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param left[IN] the child that pid was split from, or -1
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, PageId left = -1);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -210,16 +237,10 @@ int getBufferIndex()
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param left[IN] the child that pid was split from, or -1. see insert()
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
-
-    /*
-    * split contents of the node with a sibling node
-    * sibling node must be empty
-    * param OUT the midKey
-    */
-    bool split (BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, PageId left = -1);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -231,6 +252,34 @@ int getBufferIndex()
     */
     RC locateChildPtr(int searchKey, PageId& pid);
 
+   /**
+    * Given the searchKey, find the child-node pointer to follow and
+    * output it in pid. The number of index entries under the children
+    * before pid, all of which are smaller than searchKey, is output in
+    * preceding.
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param pid[OUT] the pointer to the child node to follow.
+    * @param preceding[OUT] the number of entries under the children before pid.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtr(int searchKey, PageId& pid, int& preceding);
+
+   /**
+    * Set the number of index entries under the child pid.
+    * insert() and initializeRoot() add children with no entries, so the
+    * count of a new child must be set after it is added.
+    * @param pid[IN] the child node
+    * @param count[IN] the number of (key, rid) pairs under the child
+    * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not a child of the node.
+    */
+    RC setChildCount(PageId pid, int count);
+
+   /**
+    * Return the number of index entries under the node.
+    * @return the sum of the entry counts of the children
+    */
+    int getEntryCount();
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
@@ -246,14 +295,22 @@ int getBufferIndex()
     */
     int getKeyCount();
 
+   /**
+    * Return the maximum number of keys that fit in the node.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page is pinned in the buffer pool and read in place; it is
+    * copied into the node only when the node is modified.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
-    
+
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -263,28 +320,42 @@ int getBufferIndex()
     RC write(PageId pid, PageFile& pf);
 
   private:
+    int pageSize;  // the page size of the index file. set by read()
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The main memory buffer for loading the content of the disk page
+    * that contains the node. It is allocated with the page size of the
+    * index file when the node is first modified.
     */
-    int buffer_index;
-    int keyCount;
-    int insertIndex;
-    char buffer[PageFile::PAGE_SIZE];
-
-    /* 
-     * Inserts a key into the buffer
-     * Returns True if inserts correctly
-     * Returns False if node is full
+    std::vector<char> buffer;
+
+    /**
+     * The content of the node: either the pinned page in the buffer pool
+     * (after read()), a shared empty node (for a new node) or buffer
+     * (for a modified node).
+     */
+    const char* data;
+    PinnedPage page;
+
+    /*
+     * Copy a pinned page into buffer before the node is modified
+     */
+    void materialize();
+
+    /*
+     * Make the node an empty node of the current format
      */
-    bool insertKey(int key, int insertIndex);
+    void initialize();
 
-    /* 
-     * Inserts a PageId into the buffer
-     * Returns True if inserts correctly
-     * Returns False if node is full
+    /*
+     * Update the number of keys stored in the node
+     */
+    void setKeyCount(int count);
+
+    /*
+     * The position of a new key, whose child goes after the child left
      */
-    bool insertPid(PageId pid, int insertIndex);
-}; 
+    int insertIndex(int key, PageId left);
+};
 
 #endif /* BTNODE_H */
@@ -46,7 +46,7 @@ public:
     {
         cout << "buffer[" << i << "]: " << resultBuffer[i] << endl;
     }
-    cout << "BUFFER INDEX: " << leaf.getBufferIndex() << endl;
+    cout << "KEY COUNT: " << leaf.getKeyCount() << endl;
     cout << "RAN read() TEST ON PAGE: " << pid << "\n" << endl;
   }
 
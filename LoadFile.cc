@@ -0,0 +1,238 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "LoadFile.h"
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SIMD_SCANNER
+#endif
+
+using namespace std;
+
+// the # of bytes that the first stage compares at a time
+static const int BLOCK_SIZE = 64;
+
+static const size_t NONE = (size_t) -1;
+
+/*
+ * The first stage: the bit masks of the newlines, NULs and commas in a
+ * block of BLOCK_SIZE bytes. bit i is set if byte i is the character.
+ */
+#ifdef HAVE_SIMD_SCANNER
+static inline uint64_t charMask(const __m128i* v, char c)
+{
+  __m128i k = _mm_set1_epi8(c);
+  uint64_t m0 = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[0], k));
+  uint64_t m1 = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[1], k));
+  uint64_t m2 = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[2], k));
+  uint64_t m3 = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[3], k));
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+static inline void structuralMasks(const char* block, uint64_t& newline, uint64_t& nul, uint64_t& comma)
+{
+  __m128i v[4];
+  for (int i = 0; i < 4; i++)
+    v[i] = _mm_loadu_si128((const __m128i*) (block + 16 * i));
+  newline = charMask(v, '\n');
+  nul = charMask(v, '\0');
+  comma = charMask(v, ',');
+}
+#else
+static inline void structuralMasks(const char* block, uint64_t& newline, uint64_t& nul, uint64_t& comma)
+{
+  newline = nul = comma = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    newline |= (uint64_t) (block[i] == '\n') << i;
+    nul |= (uint64_t) (block[i] == '\0') << i;
+    comma |= (uint64_t) (block[i] == ',') << i;
+  }
+}
+#endif
+
+/*
+ * Read a key from [p, end) as atoi() does: skip white spaces, read an
+ * optional sign and the digits, clamp the number to the range of long
+ * (as strtol() does) and convert it to int.
+ */
+static int parseKey(const char* p, const char* end)
+{
+  bool negative = false;
+  unsigned long value = 0;
+  unsigned long limit;
+
+  while (p < end && isspace((unsigned char) *p)) p++;
+  if (p < end && (*p == '+' || *p == '-')) negative = (*p++ == '-');
+  limit = negative ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    unsigned long digit = *p - '0';
+    if (value > (limit - digit) / 10) {
+      value = limit;
+      break;
+    }
+    value = value * 10 + digit;
+  }
+  return (int) (negative ? (long) (0 - value) : (long) value);
+}
+
+/*
+ * The second stage for one line: parse the line [begin, end), whose first
+ * comma is at comma (or NONE), into the batch.
+ */
+static void parseLine(const char* text, size_t begin, size_t end, size_t comma, LoadBatch& batch)
+{
+  const char* p = text + begin;
+  const char* e = text + end;
+  const char* value;
+  int key;
+
+  batch.lines++;
+  if (comma == NONE) return;
+
+  // the key, after the beginning white spaces
+  while (p < e && (*p == ' ' || *p == '\t')) p++;
+  key = parseKey(p, e);
+
+  // the value, after the white spaces that follow the comma.
+  // if it is delimited by ' or ", it ends at the closing quote
+  value = text + comma + 1;
+  while (value < e && (*value == ' ' || *value == '\t')) value++;
+  if (value < e && (*value == '\'' || *value == '"')) {
+    const char* close = (const char*) memchr(value + 1, *value, e - value - 1);
+    value++;
+    if (close != NULL) e = close;
+  }
+
+  batch.keys.push_back(key);
+  batch.values.push_back(value);
+  batch.lengths.push_back(e - value);
+}
+
+LoadFile::LoadFile()
+{
+  text = NULL;
+  length = 0;
+  mapped = false;
+}
+
+LoadFile::~LoadFile()
+{
+  close();
+}
+
+RC LoadFile::open(const string& filename)
+{
+  struct stat st;
+  int fd;
+
+  close();
+  if ((fd = ::open(filename.c_str(), O_RDONLY)) < 0) return RC_FILE_OPEN_FAILED;
+
+  // map a regular file. the pages are read ahead as the file is parsed
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    length = st.st_size;
+    if (length == 0) {
+      ::close(fd);
+      return 0;
+    }
+    void* addr = ::mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      ::madvise(addr, length, MADV_SEQUENTIAL);
+      text = (const char*) addr;
+      mapped = true;
+      ::close(fd);
+      return 0;
+    }
+  }
+
+  // otherwise read the whole file into memory
+  string content;
+  char   buffer[65536];
+  ssize_t n;
+  while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+    content.append(buffer, n);
+  ::close(fd);
+  if (n < 0) return RC_FILE_READ_FAILED;
+
+  char* copy = new char[content.size() + 1];
+  memcpy(copy, content.data(), content.size());
+  text = copy;
+  length = content.size();
+  return 0;
+}
+
+void LoadFile::close()
+{
+  if (mapped) ::munmap(const_cast<char*>(text), length);
+  else delete [] text;
+  text = NULL;
+  length = 0;
+  mapped = false;
+}
+
+size_t LoadFile::chunkEnd(size_t begin, size_t bytes) const
+{
+  if (bytes == 0 || begin + bytes >= length) return length;
+
+  const char* eol = (const char*) memchr(text + begin + bytes - 1, '\n', length - (begin + bytes - 1));
+  return (eol == NULL) ? length : eol - text + 1;
+}
+
+void LoadFile::parse(size_t begin, size_t end, LoadBatch& batch) const
+{
+  size_t lineBegin = begin;
+  size_t lineEnd = NONE;   // where the line ends: its first NUL or newline
+  size_t comma = NONE;     // the first comma of the line
+  char   tail[BLOCK_SIZE];
+
+  for (size_t block = begin; block < end; block += BLOCK_SIZE) {
+    uint64_t newline, nul, commas;
+    const char* bytes = text + block;
+
+    // the last block is padded with spaces, which are not structural
+    if (end - block < (size_t) BLOCK_SIZE) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, bytes, end - block);
+      bytes = tail;
+    }
+    structuralMasks(bytes, newline, nul, commas);
+
+    // walk the structural characters in the order of the file.
+    // the line is cut at a NUL, as C strings would cut it
+    for (uint64_t bits = newline | nul | commas; bits != 0; bits &= bits - 1) {
+      int i = __builtin_ctzll(bits);
+      uint64_t bit = (uint64_t) 1 << i;
+      size_t pos = block + i;
+
+      if (commas & bit) {
+        if (comma == NONE && lineEnd == NONE) comma = pos;
+      } else if (nul & bit) {
+        if (lineEnd == NONE) lineEnd = pos;
+      } else {
+        parseLine(text, lineBegin, (lineEnd == NONE) ? pos : lineEnd, comma, batch);
+        lineBegin = pos + 1;
+        lineEnd = comma = NONE;
+      }
+    }
+  }
+
+  // the last line of the file may not end with a newline
+  if (lineBegin < end)
+    parseLine(text, lineBegin, (lineEnd == NONE) ? end : lineEnd, comma, batch);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef LOADFILE_H
+#define LOADFILE_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * The tuples parsed from a part of a load file. The values point into
+ * the load file, so parsing a tuple allocates no memory.
+ */
+struct LoadBatch {
+  int lines;                         // # of lines parsed
+  std::vector<int> keys;             // the keys of the tuples
+  std::vector<const char*> values;   // the first characters of the values
+  std::vector<int> lengths;          // the lengths of the values
+
+  void clear() { lines = 0; keys.clear(); values.clear(); lengths.clear(); }
+};
+
+/**
+ * A load file mapped into memory and parsed in place.
+ *
+ * The lines are found in two stages, as in simdjson. The first stage
+ * compares 64 bytes at a time with the structural characters (newline,
+ * comma and NUL) and produces a bit mask of their positions. The second
+ * stage walks the set bits of the masks to find the end and the first
+ * comma of every line, so the parser never looks for them byte by byte.
+ *
+ * A line is parsed exactly like SqlEngine::parseLoadLine() parses it: the
+ * key is read as by atoi(), and the value is everything after the first
+ * comma and the white spaces that follow it, or the text between the
+ * quotes if it starts with ' or ". A line without a comma is skipped.
+ */
+class LoadFile {
+ public:
+  LoadFile();
+  ~LoadFile();
+
+  /**
+   * map a load file into memory. a file that cannot be mapped (e.g., a
+   * pipe) is read into memory instead.
+   * @param filename[IN] the name of the load file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * unmap the load file. the values of the batches parsed from it are
+   * no longer valid.
+   */
+  void close();
+
+  /**
+   * @return the content of the file
+   */
+  const char* data() const { return text; }
+
+  /**
+   * @return the size of the file in bytes
+   */
+  size_t size() const { return length; }
+
+  /**
+   * find the end of a chunk of the file that ends at a line boundary.
+   * @param begin[IN] the offset where the chunk starts
+   * @param bytes[IN] the size of the chunk, before it is extended to the
+   *        end of its last line
+   * @return the offset right after the last line of the chunk
+   */
+  size_t chunkEnd(size_t begin, size_t bytes) const;
+
+  /**
+   * parse the lines of the file between two line boundaries.
+   * @param begin[IN] the offset of the first line
+   * @param end[IN] the offset right after the last line
+   * @param batch[OUT] the parsed tuples are added to the batch
+   */
+  void parse(size_t begin, size_t end, LoadBatch& batch) const;
+
+ private:
+  const char* text;    // the content of the file
+  size_t      length;  // the size of the file
+  bool        mapped;  // whether text is a mapping, or a buffer from new[]
+
+  // a load file cannot be copied
+  LoadFile(const LoadFile&);
+  LoadFile& operator=(const LoadFile&);
+};
+
+#endif /* LOADFILE_H */
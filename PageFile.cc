@@ -9,26 +9,527 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+std::atomic<int> PageFile::hitCount(0);
+std::atomic<int> PageFile::missCount(0);
+std::atomic<int> PageFile::evictCount(0);
+std::atomic<int> PageFile::mappedCount(0);
+std::atomic<int> PageFile::prefetchCount(0);
+std::atomic<int> PageFile::dirtyCount(0);
+std::atomic<int> PageFile::flushCount(0);
+bool PageFile::mmapEnabled = true;
+bool PageFile::writeBack = true;
+int PageFile::defaultPageSize = PageFile::DEFAULT_PAGE_SIZE;
 
-PageFile::PageFile() 
-{ 
-  fd = -1; 
-  epid = 0; 
+//
+// The file header.
+//
+// A file created by this version of PageFile starts with a header page
+// that records its page size. Page 0 of the file follows the header, so
+// every page stays aligned to the page size. A file that does not start
+// with HEADER_MAGIC was created by an older version, which wrote
+// DEFAULT_PAGE_SIZE pages from the beginning of the file.
+//
+static const char HEADER_MAGIC[8] = "BRUINPF";
+static const int  HEADER_VERSION = 1;
+
+struct FileHeader {
+  char magic[8];   // HEADER_MAGIC
+  int  version;    // HEADER_VERSION
+  int  pageSize;   // the page size of the file
+  int  format;     // set by the user of the file. 0 in older files
+};
+
+static bool isValidPageSize(int size)
+{
+  return size >= PageFile::MIN_PAGE_SIZE && size <= PageFile::MAX_PAGE_SIZE
+      && (size & (size - 1)) == 0;
+}
+
+//
+// The buffer pool shared by all PageFiles.
+//
+// Cached pages are keyed by (fid, pid), where fid identifies the unix
+// file (device and inode) rather than the descriptor, so pages stay
+// cached when a table or index is closed and opened again by the next
+// query. The pool is split into CACHE_SHARDS independent shards. A page
+// is assigned to a shard by hashing its (fid, pid), and each shard keeps
+// its own hash table from (fid, pid) to frame and its own clock hand
+// for replacement, so a lookup only ever touches a single shard.
+// Replacement uses the clock (second chance) approximation of LRU;
+// pinned frames are never evicted.
+//
+// Files may have different page sizes, so the pool is budgeted in bytes
+// rather than in frames. Each shard has enough frame slots to fill its
+// budget with MIN_PAGE_SIZE pages, and a frame holds memory of the size
+// of the page cached in it. When a new page does not fit in the budget,
+// frames are evicted until it does; an evicted frame whose memory has
+// the right size is reused as it is.
+//
+// Each shard is protected by its own mutex. A page is read from the disk
+// without holding the mutex: its frame is pinned and marked as loading,
+// and other threads that want the same page wait on the shard's
+// condition variable until the read completes.
+//
+// With write-back, a written page is only copied into its frame, which is
+// marked dirty and remembers the descriptor and the header size of the
+// file it belongs to. A dirty frame is written to the disk before it is
+// evicted, and flush() writes all the dirty frames of a file at once.
+//
+static const int CACHE_SHARDS = 16;
+static const int DEFAULT_CACHE_MB = 16;
+static const int MIN_PAGES_PER_SHARD = 4;  // in MAX_PAGE_SIZE pages
+
+struct CacheFrame {
+  int         fid;         // file id of the cached page (-1 if empty)
+  PageId      pid;         // page id of the cached page
+  int         pinCount;    // # of outstanding pin()s on this frame
+  bool        referenced;  // clock bit: set on access, cleared by the hand
+  bool        loading;     // true while the page is being read from disk
+  bool        dirty;       // true if the page was not written to disk yet
+  int         fd;          // the file to write a dirty page to
+  int         base;        // the offset of page 0 in that file
+  CacheFrame* hashNext;    // next frame in the same hash bucket
+  char*       data;        // the cached page (NULL if no memory)
+  int         size;        // the size of data in bytes
+};
+
+struct CacheShard {
+  std::mutex   lock;        // protects everything in the shard
+  std::condition_variable loaded; // signaled when a page read completes
+  CacheFrame*  frames;      // all the frames of this shard
+  int          frameCount;  // # of frames in the shard
+  CacheFrame** buckets;     // hash table from (fid, pid) to frame
+  int          bucketCount; // # of hash buckets
+  int          hand;        // clock hand for replacement
+  long long    bytes;       // the size of the memory held by the frames
+  long long    budget;      // the maximum of bytes
+};
+
+typedef std::unique_lock<std::mutex> ShardLock;
+
+static CacheShard cacheShards[CACHE_SHARDS];
+static std::atomic<int> cacheFrameCount(0);  // total # of frames. 0 if not initialized
+static std::mutex cacheInitLock;             // serializes (re)initialization
+
+// buffer pool ids assigned to the (device, inode) of every opened file
+static std::map<std::pair<dev_t, ino_t>, int> fileIds;
+static std::mutex fileIdLock;
+
+static int fileIdOf(const struct stat& statbuf)
+{
+  std::lock_guard<std::mutex> guard(fileIdLock);
+  std::pair<dev_t, ino_t> file(statbuf.st_dev, statbuf.st_ino);
+  std::map<std::pair<dev_t, ino_t>, int>::iterator it = fileIds.find(file);
+  if (it != fileIds.end()) return it->second;
+
+  int id = (int)fileIds.size();
+  fileIds[file] = id;
+  return id;
+}
+
+static unsigned hashPage(int fid, PageId pid)
+{
+  unsigned h = (unsigned)fid * 0x9E3779B1u;
+  h ^= (unsigned)pid + 0x7F4A7C15u + (h << 6) + (h >> 2);
+  return h;
+}
+
+static void freeCache()
+{
+  cacheFrameCount = 0;
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    CacheShard& s = cacheShards[i];
+    for (int j = 0; j < s.frameCount; j++) free(s.frames[j].data);
+    free(s.frames);
+    free(s.buckets);
+    s.frames = NULL;
+    s.buckets = NULL;
+    s.frameCount = s.bucketCount = s.hand = 0;
+    s.bytes = s.budget = 0;
+  }
+}
+
+static RC initCache(int mb)
+{
+  long long budget = ((long long)mb << 20) / CACHE_SHARDS;
+  if (budget < (long long)MIN_PAGES_PER_SHARD * PageFile::MAX_PAGE_SIZE) {
+    budget = (long long)MIN_PAGES_PER_SHARD * PageFile::MAX_PAGE_SIZE;
+  }
+  int slots = (int)(budget / PageFile::MIN_PAGE_SIZE);
+
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    CacheShard& s = cacheShards[i];
+    s.frameCount  = slots;
+    s.bucketCount = slots * 2;
+    s.hand        = 0;
+    s.bytes       = 0;
+    s.budget      = budget;
+    s.frames  = (CacheFrame*) calloc(s.frameCount, sizeof(CacheFrame));
+    s.buckets = (CacheFrame**) calloc(s.bucketCount, sizeof(CacheFrame*));
+    if (s.frames == NULL || s.buckets == NULL) {
+      freeCache();
+      return RC_NO_FREE_FRAME;
+    }
+    for (int j = 0; j < s.frameCount; j++) {
+      s.frames[j].fid = -1;
+    }
+  }
+  cacheFrameCount = slots * CACHE_SHARDS;
+  return 0;
+}
+
+// create the buffer pool with the default size on first use
+static RC ensureCache()
+{
+  if (cacheFrameCount > 0) return 0;
+
+  std::lock_guard<std::mutex> guard(cacheInitLock);
+  if (cacheFrameCount > 0) return 0;
+  return initCache(DEFAULT_CACHE_MB);
+}
+
+// find the shard and the hash bucket that a page belongs to
+static CacheShard& shardOf(int fid, PageId pid, CacheFrame**& bucket)
+{
+  unsigned h = hashPage(fid, pid);
+  CacheShard& s = cacheShards[h % CACHE_SHARDS];
+  bucket = &s.buckets[(h / CACHE_SHARDS) % s.bucketCount];
+  return s;
+}
+
+static CacheShard& shardOf(int fid, PageId pid)
+{
+  return cacheShards[hashPage(fid, pid) % CACHE_SHARDS];
+}
+
+// look up a page in the cache. returns NULL if it is not cached.
+// the shard lock must be held.
+static CacheFrame* lookupFrame(int fid, PageId pid)
+{
+  CacheFrame** bucket;
+  shardOf(fid, pid, bucket);
+  for (CacheFrame* f = *bucket; f != NULL; f = f->hashNext) {
+    if (f->fid == fid && f->pid == pid) return f;
+  }
+  return NULL;
+}
+
+// remove a frame from its hash chain and mark it empty.
+// the shard lock must be held.
+static void dropFrame(CacheFrame* frame)
+{
+  CacheFrame** bucket;
+  shardOf(frame->fid, frame->pid, bucket);
+  for (CacheFrame** p = bucket; *p != NULL; p = &(*p)->hashNext) {
+    if (*p == frame) { *p = frame->hashNext; break; }
+  }
+  frame->fid = -1;
+  frame->hashNext = NULL;
+  frame->referenced = false;
+  frame->loading = false;
+  frame->dirty = false;
+}
+
+// write a dirty frame to the disk and mark it clean.
+// returns false if the write failed.
+static bool writeFrame(CacheFrame* frame)
+{
+  off_t offset = frame->base + (off_t)frame->pid * frame->size;
+  if (::pwrite(frame->fd, frame->data, frame->size, offset) != frame->size) return false;
+  frame->dirty = false;
+  return true;
+}
+
+// pick an unpinned frame in the page's shard with the clock algorithm,
+// give it size bytes of memory and assign it to (fid, pid). a dirty page
+// is written to the disk before its frame is reused, and flushed is set
+// to the # of such writes. returns NULL if not enough frames can be
+// evicted to make room. the shard lock must be held.
+static CacheFrame* allocFrame(int fid, PageId pid, int size, int& evicted, int& flushed)
+{
+  CacheFrame** bucket;
+  CacheShard& s = shardOf(fid, pid, bucket);
+  CacheFrame* victim = NULL;
+
+  evicted = flushed = 0;
+  // two full sweeps clear every reference bit once, and a third one
+  // evicts enough pages to make room for any page size
+  for (int n = 0; n < 3 * s.frameCount; n++) {
+    CacheFrame* f = &s.frames[s.hand];
+    s.hand = (s.hand + 1) % s.frameCount;
+    if (f->pinCount > 0) continue;
+    if (f->fid >= 0) {
+      if (f->referenced) { f->referenced = false; continue; }
+      if (f->dirty) {
+        if (!writeFrame(f)) continue;
+        flushed++;
+      }
+      dropFrame(f);
+      evicted++;
+    }
+
+    // the frame is empty now. reuse its memory if it has the right size
+    if (f->size == size) { victim = f; break; }
+    if (f->data != NULL) {
+      free(f->data);
+      s.bytes -= f->size;
+      f->data = NULL;
+      f->size = 0;
+    }
+
+    // otherwise allocate new memory if it fits in the budget
+    if (s.bytes + size <= s.budget) {
+      if ((f->data = (char*) malloc(size)) == NULL) return NULL;
+      f->size = size;
+      s.bytes += size;
+      victim = f;
+      break;
+    }
+  }
+  if (victim == NULL) return NULL;
+
+  victim->fid = fid;
+  victim->pid = pid;
+  victim->pinCount = 0;
+  victim->referenced = true;
+  victim->loading = false;
+  victim->dirty = false;
+  victim->hashNext = *bucket;
+  *bucket = victim;
+  return victim;
+}
+
+//
+// The read-ahead threads.
+//
+// prefetch() puts the pages to read ahead on a queue, and PREFETCH_THREADS
+// background threads read them into the buffer pool, so that several
+// reads can be in flight while the caller is busy with the pages it
+// already has. The threads are started when prefetch() is first called.
+// A request refers to the unix file descriptor of its PageFile, so
+// close() removes the file's pending requests from the queue and waits
+// until no thread is still reading from the descriptor.
+//
+static const int PREFETCH_THREADS = 2;
+static const size_t PREFETCH_QUEUE_MAX = 1024;  // pending requests beyond this are dropped
+
+struct PrefetchRequest {
+  int    fd;      // the file to read from
+  int    fid;     // the buffer pool id of the file
+  PageId pid;     // the page to read
+  int    psize;   // the page size of the file
+  int    base;    // the offset of page 0 in the file
+};
+
+struct Prefetcher {
+  std::mutex lock;                      // protects everything below
+  std::condition_variable queued;       // signaled when a request is queued
+  std::condition_variable done;         // signaled when a request is finished
+  std::deque<PrefetchRequest> queue;    // the pages to read
+  int  busy[PREFETCH_THREADS];          // the fd each thread is reading, or -1
+  std::thread threads[PREFETCH_THREADS];
+  bool started;
+  bool stopping;
+
+  Prefetcher() : started(false), stopping(false) {
+    for (int i = 0; i < PREFETCH_THREADS; i++) busy[i] = -1;
+  }
+
+  // stop the threads at program exit
+  ~Prefetcher() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+      queue.clear();
+    }
+    queued.notify_all();
+    for (int i = 0; i < PREFETCH_THREADS; i++) {
+      if (threads[i].joinable()) threads[i].join();
+    }
+  }
+};
+
+static Prefetcher prefetcher;
+
+// read a page into the buffer pool unless it is already there.
+// returns true if the page was read from the disk.
+static bool loadPage(const PrefetchRequest& r, int& evicted, int& flushed)
+{
+  CacheFrame* f;
+
+  evicted = flushed = 0;
+  if (ensureCache() < 0) return false;
+
+  CacheShard& s = shardOf(r.fid, r.pid);
+  ShardLock guard(s.lock);
+
+  // the page is cached or somebody is reading it already
+  if (lookupFrame(r.fid, r.pid) != NULL) return false;
+
+  // pin the frame while the page is being read, exactly as pin() does
+  if ((f = allocFrame(r.fid, r.pid, r.psize, evicted, flushed)) == NULL) return false;
+  f->pinCount = 1;
+  f->loading = true;
+  guard.unlock();
+
+  ssize_t n = ::pread(r.fd, f->data, r.psize, r.base + (off_t)r.pid * r.psize);
+
+  guard.lock();
+  f->loading = false;
+  f->pinCount = 0;
+  s.loaded.notify_all();
+
+  // a failed or short read is not cached; pin() will read the page again
+  if (n != r.psize) {
+    dropFrame(f);
+    return false;
+  }
+  return true;
+}
+
+void PageFile::countEvictions(int evicted, int flushed)
+{
+  evictCount += evicted;
+  dirtyCount -= flushed;
+  writeCount += flushed;
+  flushCount += flushed;
+}
+
+void PageFile::prefetchThread(int id)
+{
+  std::unique_lock<std::mutex> guard(prefetcher.lock);
+  for (;;) {
+    while (prefetcher.queue.empty() && !prefetcher.stopping) {
+      prefetcher.queued.wait(guard);
+    }
+    if (prefetcher.stopping) return;
+
+    PrefetchRequest r = prefetcher.queue.front();
+    prefetcher.queue.pop_front();
+    prefetcher.busy[id] = r.fd;
+    guard.unlock();
+
+    int evicted, flushed;
+    if (loadPage(r, evicted, flushed)) {
+      readCount++;
+      prefetchCount++;
+    }
+    countEvictions(evicted, flushed);
+
+    guard.lock();
+    prefetcher.busy[id] = -1;
+    prefetcher.done.notify_all();
+  }
+}
+
+// remove the pending requests of a file and wait for the ones in flight
+static void cancelPrefetch(int fd)
+{
+  std::unique_lock<std::mutex> guard(prefetcher.lock);
+  if (!prefetcher.started) return;
+
+  std::deque<PrefetchRequest>::iterator it = prefetcher.queue.begin();
+  while (it != prefetcher.queue.end()) {
+    if (it->fd == fd) it = prefetcher.queue.erase(it);
+    else ++it;
+  }
+
+  for (int i = 0; i < PREFETCH_THREADS; i++) {
+    while (prefetcher.busy[i] == fd) prefetcher.done.wait(guard);
+  }
+}
+
+RC PageFile::setDefaultPageSize(int size)
+{
+  if (!isValidPageSize(size)) return RC_INVALID_FILE_FORMAT;
+  defaultPageSize = size;
+  return 0;
+}
+
+RC PageFile::setCacheSize(int mb)
+{
+  if (mb <= 0) return RC_NO_FREE_FRAME;
+
+  std::lock_guard<std::mutex> guard(cacheInitLock);
+
+  // the pool cannot be resized while somebody holds a pinned page
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    for (int j = 0; j < cacheShards[i].frameCount; j++) {
+      if (cacheShards[i].frames[j].pinCount > 0) return RC_NO_FREE_FRAME;
+    }
+  }
+
+  // write the dirty pages, after which the cached pages can simply be dropped
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    for (int j = 0; j < cacheShards[i].frameCount; j++) {
+      CacheFrame* f = &cacheShards[i].frames[j];
+      if (f->fid < 0 || !f->dirty) continue;
+      if (!writeFrame(f)) return RC_FILE_WRITE_FAILED;
+      dirtyCount--;
+      writeCount++;
+      flushCount++;
+    }
+  }
+  freeCache();
+  return initCache(mb);
+}
+
+// drop every cached page of a file. the dirty pages were written through
+// another descriptor that is still open, so they are current and are kept.
+// pinned pages are kept too, since somebody is still using them
+static void dropFile(int fid)
+{
+  if (cacheFrameCount == 0) return;
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    ShardLock guard(cacheShards[i].lock);
+    for (int j = 0; j < cacheShards[i].frameCount; j++) {
+      CacheFrame* f = &cacheShards[i].frames[j];
+      if (f->fid == fid && !f->dirty && f->pinCount == 0) dropFrame(f);
+    }
+  }
+}
+
+PageFile::PageFile()
+{
+  fd = -1;
+  fid = -1;
+  epid = 0;
+  psize = DEFAULT_PAGE_SIZE;
+  base = 0;
+  format = 0;
+  mapped = NULL;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
+  fid = -1;
   epid = 0;
+  psize = DEFAULT_PAGE_SIZE;
+  base = 0;
+  format = 0;
+  mapped = NULL;
   open(filename.c_str(), mode);
 }
 
@@ -37,6 +538,7 @@ RC PageFile::open(const string& filename, char mode)
   RC   rc;
   int  oflag;
   struct stat statbuf;
+  FileHeader header;
 
   if (fd > 0) return RC_FILE_OPEN_FAILED;
 
@@ -58,65 +560,295 @@ RC PageFile::open(const string& filename, char mode)
   fd = ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
 
-  // get the size of the file to set the end pid
+  // get the size of the file
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+
+  //
+  // find the page size of the file from its header
+  //
+  psize = DEFAULT_PAGE_SIZE;
+  base = 0;
+  format = 0;
+  if (statbuf.st_size == 0 && oflag != O_RDONLY) {
+    // a new file. write the header with the default page size
+    char* page = (char*) calloc(1, defaultPageSize);
+    memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+    header.version = HEADER_VERSION;
+    header.pageSize = defaultPageSize;
+    header.format = 0;
+    memcpy(page, &header, sizeof(header));
+    ssize_t n = (page != NULL) ? ::pwrite(fd, page, defaultPageSize, 0) : -1;
+    free(page);
+    if (n != defaultPageSize) { ::close(fd); fd = -1; return RC_FILE_WRITE_FAILED; }
+    psize = base = defaultPageSize;
+    statbuf.st_size = base;
+  } else if (statbuf.st_size >= (off_t)sizeof(header) &&
+             ::pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+             memcmp(header.magic, HEADER_MAGIC, sizeof(header.magic)) == 0) {
+    // a file with a header
+    if (header.version != HEADER_VERSION || !isValidPageSize(header.pageSize)) {
+      ::close(fd); fd = -1; return RC_INVALID_FILE_FORMAT;
+    }
+    psize = base = header.pageSize;
+    format = header.format;
+  }
+
+  // set the end pid
+  epid = (statbuf.st_size > base) ? (statbuf.st_size - base) / psize : 0;
+
+  // an empty file may reuse the inode of a file deleted earlier,
+  // so make sure that none of its old pages are still cached
+  fid = fileIdOf(statbuf);
+  if (epid == 0) dropFile(fid);
+
+  // a read-only file is memory-mapped, so that reading a page is just
+  // a pointer into the mapping. if mmap fails, we fall back to the
+  // buffer pool.
+  if (oflag == O_RDONLY && mmapEnabled && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t)base + (size_t)epid * psize, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) mapped = (const char*) addr;
+  }
 
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
+  // write the dirty pages. the pages that cannot be written are discarded,
+  // since they must not be written to whatever file gets the descriptor next
+  if ((rc = flush()) < 0) discardDirty();
+
+  // unmap the file if it is memory-mapped
+  if (mapped != NULL) {
+    ::munmap(const_cast<char*>(mapped), (size_t)base + (size_t)epid * psize);
+    mapped = NULL;
+  }
+
+  // the read-ahead threads must be done with the descriptor
+  cancelPrefetch(fd);
+
   // close the file
   if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
-  }
+  // the cached pages of the file are kept in the buffer pool,
+  // so that they can be reused when the file is opened again.
 
   // set the fd and epid to the initial state
-  fd = -1; 
+  fd = -1;
+  fid = -1;
   epid = 0;
+  psize = DEFAULT_PAGE_SIZE;
+  base = 0;
+  format = 0;
+  return rc;
+}
+
+// a dirty page to be written by flush()
+struct DirtyPage {
+  PageId      pid;
+  CacheFrame* frame;
+  CacheShard* shard;
+
+  bool operator<(const DirtyPage& other) const { return pid < other.pid; }
+};
+
+// pin every dirty page that was written through the descriptor fd
+static void collectDirty(int fid, int fd, std::vector<DirtyPage>& pages)
+{
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    CacheShard& s = cacheShards[i];
+    ShardLock guard(s.lock);
+    for (int j = 0; j < s.frameCount; j++) {
+      CacheFrame* f = &s.frames[j];
+      if (f->fid == fid && f->dirty && f->fd == fd) {
+        f->pinCount++;
+        DirtyPage page = { f->pid, f, &s };
+        pages.push_back(page);
+      }
+    }
+  }
+}
+
+RC PageFile::flush()
+{
+  std::vector<DirtyPage> pages;
+  std::vector<struct iovec> iov;
+  RC rc = 0;
+
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (mapped != NULL || cacheFrameCount == 0) return 0;
+
+  collectDirty(fid, fd, pages);
+  if (pages.empty()) return 0;
+  std::sort(pages.begin(), pages.end());
+
+  // write every run of consecutive pages with a single pwritev()
+  for (size_t begin = 0, end; begin < pages.size(); begin = end) {
+    iov.clear();
+    for (end = begin; end < pages.size() && (int)(end - begin) < IOV_MAX; end++) {
+      if (end > begin && pages[end].pid != pages[end - 1].pid + 1) break;
+      struct iovec v = { pages[end].frame->data, (size_t)psize };
+      iov.push_back(v);
+    }
+
+    ssize_t bytes = (ssize_t)(end - begin) * psize;
+    if (::pwritev(fd, &iov[0], (int)iov.size(), base + (off_t)pages[begin].pid * psize) != bytes) {
+      rc = RC_FILE_WRITE_FAILED;
+      continue;
+    }
+    flushCount++;
+    writeCount += (int)(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      ShardLock guard(pages[i].shard->lock);
+      pages[i].frame->dirty = false;
+      dirtyCount--;
+    }
+  }
+
+  // unpin the pages
+  for (size_t i = 0; i < pages.size(); i++) {
+    ShardLock guard(pages[i].shard->lock);
+    pages[i].frame->pinCount--;
+  }
+  return rc;
+}
+
+void PageFile::discardDirty()
+{
+  if (cacheFrameCount == 0) return;
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    ShardLock guard(cacheShards[i].lock);
+    for (int j = 0; j < cacheShards[i].frameCount; j++) {
+      CacheFrame* f = &cacheShards[i].frames[j];
+      if (f->fid == fid && f->dirty && f->fd == fd) {
+        dirtyCount--;
+        dropFrame(f);
+      }
+    }
+  }
+}
+
+RC PageFile::setFormat(int number)
+{
+  FileHeader header;
+
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (base == 0) return RC_INVALID_FILE_FORMAT;
+  if (mapped != NULL) return RC_INVALID_FILE_MODE;
+
+  memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+  header.version = HEADER_VERSION;
+  header.pageSize = psize;
+  header.format = number;
+  if (::pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  format = number;
   return 0;
 }
 
-PageId PageFile::endPid() const 
+PageId PageFile::endPid() const
 {
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::setAccessPattern(int pattern) const
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  int advice;
+
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+
+  if (mapped != NULL) {
+    switch (pattern) {
+    case ACCESS_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case ACCESS_RANDOM:     advice = MADV_RANDOM;     break;
+    default:                advice = MADV_NORMAL;     break;
+    }
+    if (::madvise(const_cast<char*>(mapped), (size_t)base + (size_t)epid * psize, advice) < 0) {
+      return RC_FILE_READ_FAILED;
+    }
+  } else {
+    switch (pattern) {
+    case ACCESS_SEQUENTIAL: advice = POSIX_FADV_SEQUENTIAL; break;
+    case ACCESS_RANDOM:     advice = POSIX_FADV_RANDOM;     break;
+    default:                advice = POSIX_FADV_NORMAL;     break;
+    }
+    if (::posix_fadvise(fd, 0, 0, advice) != 0) return RC_FILE_READ_FAILED;
+  }
+  return 0;
+}
+
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (pid < 0 || count <= 0) return RC_INVALID_PID;
+
+  // ignore the pages beyond the end of the file
+  if (pid >= epid) return 0;
+  if (count > epid - pid) count = epid - pid;
+
+  // the kernel reads a memory-mapped file ahead on its own
+  if (mapped != NULL) {
+    size_t begin = base + (size_t)pid * psize;
+    if (::madvise(const_cast<char*>(mapped) + begin, (size_t)count * psize, MADV_WILLNEED) < 0) {
+      return RC_FILE_READ_FAILED;
+    }
+    return 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(prefetcher.lock);
+    if (!prefetcher.started) {
+      for (int i = 0; i < PREFETCH_THREADS; i++) {
+        prefetcher.threads[i] = std::thread(prefetchThread, i);
+      }
+      prefetcher.started = true;
+    }
+
+    for (int i = 0; i < count && prefetcher.queue.size() < PREFETCH_QUEUE_MAX; i++) {
+      PrefetchRequest r = { fd, fid, pid + i, psize, base };
+      prefetcher.queue.push_back(r);
+    }
+  }
+  prefetcher.queued.notify_all();
+  return 0;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  if (pid < 0) return RC_INVALID_PID;
+  if (mapped != NULL) return RC_INVALID_FILE_MODE;
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
+  // with write-back, copy the buffer into the page's frame and mark it
+  // dirty. if no frame can be found for it, write the page through
+  if (writeBack && writeCached(pid, buffer)) {
+    if (pid >= epid) epid = pid + 1;
+    return 0;
+  }
 
   // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  if (::pwrite(fd, buffer, psize, base + (off_t)pid * psize) != psize) {
+    return RC_FILE_WRITE_FAILED;
+  }
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  // if the page is in the buffer pool, keep the cached copy up to date.
+  // if a read-ahead thread is still reading it, wait for the old content.
+  if (cacheFrameCount > 0) {
+    CacheFrame* f;
+    CacheShard& s = shardOf(fid, pid);
+    ShardLock guard(s.lock);
+    while ((f = lookupFrame(fid, pid)) != NULL && f->loading) {
+      s.loaded.wait(guard);
+    }
+    if (f != NULL && f->data != buffer) memcpy(f->data, buffer, psize);
+    if (f != NULL && f->dirty) {
+      f->dirty = false;
+      dirtyCount--;
     }
   }
 
@@ -129,50 +861,247 @@ RC PageFile::write(PageId pid, const void* buffer)
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+bool PageFile::writeCached(PageId pid, const void* buffer)
+{
+  CacheFrame* f;
+  int evicted, flushed;
+
+  if (ensureCache() < 0) return false;
+
+  CacheShard& s = shardOf(fid, pid);
+  ShardLock guard(s.lock);
+
+  // if a read-ahead thread is still reading the page, wait for it, so
+  // that it does not overwrite the new content with the old one
+  while ((f = lookupFrame(fid, pid)) != NULL && f->loading) {
+    s.loaded.wait(guard);
+  }
+  if (f == NULL) {
+    f = allocFrame(fid, pid, psize, evicted, flushed);
+    countEvictions(evicted, flushed);
+    if (f == NULL) return false;
+  }
+
+  if (f->data != buffer) memcpy(f->data, buffer, psize);
+  f->referenced = true;
+  if (!f->dirty) {
+    f->dirty = true;
+    dirtyCount++;
+  }
+  f->fd = fd;
+  f->base = base;
+  return true;
+}
+
+RC PageFile::pin(PageId pid, const char*& page) const
 {
   RC rc;
+  CacheFrame* f;
+  int evicted, flushed;
+
+  if (pid < 0) return RC_INVALID_PID;
+
+  // a page of a memory-mapped file is read directly from the mapping
+  if (mapped != NULL) {
+    if (pid >= epid) return RC_INVALID_PID;
+    page = mapped + base + (size_t)pid * psize;
+    mappedCount++;
+    return 0;
+  }
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  if ((rc = ensureCache()) < 0) return rc;
+
+  CacheShard& s = shardOf(fid, pid);
+  ShardLock guard(s.lock);
 
   //
-  // if the page is in cache, read it from there
+  // if the page is in the buffer pool, pin it there.
+  // if another thread is still reading it, wait for the read to finish.
+  // a page beyond the end of the file is in the pool only while it is
+  // pinned by pinForWrite(), and it is read from there.
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
-  }
-
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
-    }
+  while ((f = lookupFrame(fid, pid)) != NULL && f->loading) {
+    s.loaded.wait(guard);
+  }
+  if (f != NULL) {
+    f->pinCount++;
+    f->referenced = true;
+    page = f->data;
+    hitCount++;
+    return 0;
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+  if (pid >= epid) return RC_INVALID_PID;
+  missCount++;
+
+  // find a frame to hold the page, and pin it while it is being read
+  f = allocFrame(fid, pid, psize, evicted, flushed);
+  countEvictions(evicted, flushed);
+  if (f == NULL) return RC_NO_FREE_FRAME;
+  f->pinCount = 1;
+  f->loading = true;
+  guard.unlock();
+
+  // read the page from the disk into the frame
+  ssize_t n = ::pread(fd, f->data, psize, base + (off_t)pid * psize);
+
+  guard.lock();
+  f->loading = false;
+  s.loaded.notify_all();
+
+  // a short read (e.g., the file was truncated) would leave a part of
+  // the frame stale, so it fails like any other read error
+  if (n != psize) {
+    dropFrame(f);
+    f->pinCount = 0;
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
   // increase the page read count
   readCount++;
 
+  page = f->data;
+  return 0;
+}
+
+RC PageFile::pinForWrite(PageId pid, char*& page)
+{
+  RC rc;
+  CacheFrame* f;
+  int evicted, flushed;
+  const char* cpage;
+
+  if (pid < 0) return RC_INVALID_PID;
+  if (mapped != NULL) return RC_INVALID_FILE_MODE;
+
+  // an existing page is pinned in the same way as for reading
+  if (pid < epid) {
+    if ((rc = pin(pid, cpage)) < 0) return rc;
+    page = const_cast<char*>(cpage);
+    return 0;
+  }
+
+  if ((rc = ensureCache()) < 0) return rc;
+
+  CacheShard& s = shardOf(fid, pid);
+  ShardLock guard(s.lock);
+
+  // a page beyond the end of the file starts out as zeros
+  if ((f = lookupFrame(fid, pid)) == NULL) {
+    f = allocFrame(fid, pid, psize, evicted, flushed);
+    countEvictions(evicted, flushed);
+    if (f == NULL) return RC_NO_FREE_FRAME;
+    memset(f->data, 0, psize);
+  }
+
+  f->pinCount++;
+  page = f->data;
+  return 0;
+}
+
+RC PageFile::markDirty(PageId pid)
+{
+  CacheFrame* f;
+
+  if (cacheFrameCount == 0) return RC_INVALID_PID;
+
+  {
+    CacheShard& s = shardOf(fid, pid);
+    ShardLock guard(s.lock);
+    f = lookupFrame(fid, pid);
+    if (f == NULL || f->pinCount <= 0) return RC_INVALID_PID;
+  }
+
+  // write the cached page to the disk, or mark it dirty.
+  // the frame cannot go away while it is pinned.
+  return write(pid, f->data);
+}
+
+RC PageFile::unpin(PageId pid) const
+{
+  CacheFrame* f;
+
+  // pages of a memory-mapped file are never pinned in the buffer pool
+  if (mapped != NULL) return 0;
+
+  if (cacheFrameCount == 0) return RC_INVALID_PID;
+
+  CacheShard& s = shardOf(fid, pid);
+  ShardLock guard(s.lock);
+  f = lookupFrame(fid, pid);
+  if (f == NULL || f->pinCount <= 0) return RC_INVALID_PID;
+  f->pinCount--;
+
+  // a new page that was never written is not part of the file
+  if (f->pinCount == 0 && pid >= epid) dropFrame(f);
   return 0;
 }
+
+RC PageFile::read(PageId pid, void* buffer) const
+{
+  RC rc;
+  const char* page;
+
+  // pin the page in the buffer pool and copy it to the buffer
+  if ((rc = pin(pid, page)) < 0) return rc;
+  memcpy(buffer, page, psize);
+  return unpin(pid);
+}
+
+PinnedPage::PinnedPage()
+{
+  pf = NULL;
+  wpf = NULL;
+  pid = -1;
+  page = NULL;
+}
+
+PinnedPage::~PinnedPage()
+{
+  release();
+}
+
+RC PinnedPage::pin(const PageFile& file, PageId id)
+{
+  RC rc;
+
+  release();
+  if ((rc = file.pin(id, page)) < 0) {
+    page = NULL;
+    return rc;
+  }
+  pf = &file;
+  pid = id;
+  return 0;
+}
+
+RC PinnedPage::pinForWrite(PageFile& file, PageId id)
+{
+  RC rc;
+  char* wpage;
+
+  release();
+  if ((rc = file.pinForWrite(id, wpage)) < 0) return rc;
+  pf = wpf = &file;
+  pid = id;
+  page = wpage;
+  return 0;
+}
+
+RC PinnedPage::markDirty()
+{
+  if (wpf == NULL) return RC_INVALID_FILE_MODE;
+  return wpf->markDirty(pid);
+}
+
+RC PinnedPage::release()
+{
+  RC rc;
+
+  if (pf == NULL) return 0;
+  rc = pf->unpin(pid);
+  pf = NULL;
+  wpf = NULL;
+  pid = -1;
+  page = NULL;
+  return rc;
+}
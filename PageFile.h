@@ -10,25 +10,48 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <atomic>
 #include <string>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ * the page size is chosen when a file is created and recorded in a
+ * header at the beginning of the file. files without the header are
+ * read as headerless files with DEFAULT_PAGE_SIZE pages.
+ * written pages are kept in the buffer pool (see setWriteBack()) and
+ * reach the disk when they are evicted, or when flush() or close() is
+ * called.
+ * pages are read and written with positional I/O and the buffer pool is
+ * shared safely between threads, so any number of threads may read pages
+ * concurrently, even through the same PageFile. open(), close(), flush()
+ * and write() on one PageFile must not run concurrently with other calls on it.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  // the page size of a file is a power of two between these two sizes
+  static const int MIN_PAGE_SIZE = 1024;      // 1KB
+  static const int MAX_PAGE_SIZE = 65536;     // 64KB
+  static const int DEFAULT_PAGE_SIZE = 1024;  // the page size of old files
+
+  // access pattern hints for setAccessPattern()
+  static const int ACCESS_NORMAL     = 0;
+  static const int ACCESS_SEQUENTIAL = 1;
+  static const int ACCESS_RANDOM     = 2;
 
   PageFile();
   PageFile(const std::string& filename, char mode);
 
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the page size set by setDefaultPageSize().
+   * when opened in 'r' mode, the file is memory-mapped (unless disabled
+   * by setMmapEnabled()) and its pages are read directly from the mapping
+   * instead of going through the buffer pool.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
    * @return error code. 0 if no error
@@ -36,15 +59,22 @@ class PageFile {
   RC open(const std::string& filename, char mode);
 
   /**
-   * close the file.
+   * close the file. the dirty pages of the file are written first.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * write the dirty pages of the file in the buffer pool to the disk.
+   * runs of consecutive pages are written with a single pwritev().
+   * @return error code. 0 if no error
+   */
+  RC flush();
   
   /**
    * read a disk page into memory buffer.
    * @param pid[IN] the page to read
-   * @param buffer[OUT] pointer to memory buffer
+   * @param buffer[OUT] pointer to memory buffer of getPageSize() bytes
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
@@ -53,6 +83,8 @@ class PageFile {
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * with write-back enabled, the page is only copied into the buffer pool
+   * and marked dirty; it reaches the disk when it is evicted or flushed.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
@@ -66,47 +98,272 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the size of a page of the file in bytes
+   */
+  int getPageSize() const { return psize; }
+
+  /**
+   * @return the format number recorded in the header of the file by
+   * setFormat(). 0 if it was never set or the file has no header.
+   */
+  int getFormat() const { return format; }
+
+  /**
+   * record a format number in the header of the file, so that the user
+   * of the file (e.g., RecordFile) knows how its pages are laid out.
+   * @param format[IN] the format number
+   * @return error code. RC_INVALID_FILE_FORMAT if the file has no header
+   */
+  RC setFormat(int format);
+
+  /**
+   * set the page size of the files created from now on.
+   * files that already exist keep the page size they were created with.
+   * @param size[IN] a power of two between MIN_PAGE_SIZE and MAX_PAGE_SIZE
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * pin a page in the buffer pool and return a pointer to the cached copy.
+   * the page stays in memory until it is unpinned, so the caller can read
+   * it in place instead of copying it out with read().
+   * every successful pin() must be matched by exactly one unpin().
+   * a page beyond endPid() can be pinned while pinForWrite() holds it.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the cached page (getPageSize() bytes)
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, const char*& page) const;
+
+  /**
+   * pin a page in the buffer pool for modification.
+   * if (pid >= endPid()), a zero-filled page is pinned instead of reading
+   * the disk; it becomes part of the file once it is marked dirty.
+   * changes made to the page reach the disk only through markDirty().
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the cached page (getPageSize() bytes)
+   * @return error code. 0 if no error
+   */
+  RC pinForWrite(PageId pid, char*& page);
+
+  /**
+   * tell the PageFile that a page pinned by pinForWrite() was modified.
+   * the cached page is written to the disk page (or marked dirty),
+   * expanding the file if necessary, exactly as write() would do.
+   * @param pid[IN] the modified page
+   * @return error code. 0 if no error
+   */
+  RC markDirty(PageId pid);
+
+  /**
+   * release a page pinned by pin() or pinForWrite().
+   * @param pid[IN] the page to unpin
+   * @return error code. 0 if no error
+   */
+  RC unpin(PageId pid) const;
+
+  /**
+   * tell the operating system how the pages of the file will be accessed,
+   * so that it can read ahead (ACCESS_SEQUENTIAL) or not (ACCESS_RANDOM).
+   * @param pattern[IN] ACCESS_NORMAL, ACCESS_SEQUENTIAL or ACCESS_RANDOM
+   * @return error code. 0 if no error
+   */
+  RC setAccessPattern(int pattern) const;
+
+  /**
+   * start reading pages into memory in the background, so that a later
+   * pin() or read() of them does not wait for the disk.
+   * the function returns immediately. pages that are already cached are
+   * skipped, and pages beyond endPid() are ignored.
+   * @param pid[IN] the first page to read ahead
+   * @param count[IN] the number of pages to read ahead
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const;
+
+  /**
+   * @return true if the file is memory-mapped
+   */
+  bool isMapped() const { return mapped != NULL; }
+
+  /**
+   * enable or disable memory-mapping of files opened in 'r' mode.
+   * it is enabled by default.
+   * @param enabled[IN] true to memory-map read-only files
+   */
+  static void setMmapEnabled(bool enabled) { mmapEnabled = enabled; }
+
+  /**
+   * enable or disable write-back. with write-back, write() dirties the
+   * cached page instead of writing it to the disk, so a page that is
+   * written many times (e.g., the root of an index) is written to the
+   * disk only once. it is enabled by default. when it is disabled,
+   * every write() goes to the disk right away.
+   * @param enabled[IN] true to keep written pages in the buffer pool
+   */
+  static void setWriteBack(bool enabled) { writeBack = enabled; }
+
+  /**
+   * set the size of the buffer pool shared by all PageFiles.
+   * this should be called at startup before any page is read,
+   * and before other threads start using PageFiles.
+   * @param mb[IN] the size of the buffer pool in megabytes
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSize(int mb);
+
   /**
    * @return the total # of disk reads
    */
-  static int getPageReadCount()  { return readCount; }
+  static int getPageReadCount()  { return readCount.load(); }
   
   /**
-   * @return the total # of disk writes
+   * @return the total # of pages written to the disk
    */
-  static int getPageWriteCount() { return writeCount; }
+  static int getPageWriteCount() { return writeCount.load(); }
 
- protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
+   * @return the # of dirty pages in the buffer pool, not written yet
    */
-  RC seek(PageId pid) const;
+  static int getDirtyPageCount() { return dirtyCount.load(); }
+
+  /**
+   * @return the total # of write system calls that wrote dirty pages
+   * (each writes one page, or a run of consecutive pages)
+   */
+  static int getFlushCount() { return flushCount.load(); }
+
+  /**
+   * @return the total # of page reads served from memory-mapped files
+   */
+  static int getMappedReadCount() { return mappedCount.load(); }
+
+  /**
+   * @return the total # of pages read into the buffer pool by prefetch()
+   */
+  static int getPrefetchCount() { return prefetchCount.load(); }
+
+  /**
+   * @return the total # of page requests served from the buffer pool
+   */
+  static int getCacheHitCount() { return hitCount.load(); }
+
+  /**
+   * @return the total # of page requests that missed the buffer pool
+   */
+  static int getCacheMissCount() { return missCount.load(); }
+
+  /**
+   * @return the total # of pages evicted from the buffer pool
+   */
+  static int getCacheEvictionCount() { return evictCount.load(); }
 
  private:
   int     fd;     // file descriptor of the associated unix file
+  int     fid;    // id of the file in the buffer pool (stable across opens)
   PageId  epid;   // (last page id + 1) of the file
+  int     psize;  // the page size of the file
+  int     base;   // the offset of page 0 in the file (the header size)
+  int     format; // the format number in the header of the file
+  const char* mapped;  // the memory mapping of a read-only file, or NULL
+
+  static bool mmapEnabled;     // whether read-only files are memory-mapped
+  static bool writeBack;       // whether written pages are kept dirty in the pool
+  static int  defaultPageSize; // the page size of newly created files
+
+  // the body of a read-ahead thread started by prefetch()
+  static void prefetchThread(int id);
+
+  // copy a page into its frame and mark it dirty.
+  // returns false if no frame can be found for it
+  bool writeCached(PageId pid, const void* buffer);
+
+  // drop the dirty pages written through this file's descriptor
+  void discardDirty();
+
+  // add the evictions (and the writes of the dirty pages they caused)
+  // to the statistics
+  static void countEvictions(int evicted, int flushed);
 
   //
-  // the following set of members implement LRU caching 
+  // the page cache itself (a sharded buffer pool keyed by (fid, pid))
+  // is implemented in PageFile.cc. only the statistics live here.
   //
-  static const int CACHE_COUNT = 10;
+  static std::atomic<int> readCount;   // total # of page reads 
+  static std::atomic<int> writeCount;  // total # of page writes 
+  static std::atomic<int> hitCount;    // total # of buffer pool hits
+  static std::atomic<int> missCount;   // total # of buffer pool misses
+  static std::atomic<int> evictCount;  // total # of buffer pool evictions
+  static std::atomic<int> mappedCount; // total # of page reads from mapped files
+  static std::atomic<int> prefetchCount; // total # of pages read by prefetch()
+  static std::atomic<int> dirtyCount;  // # of dirty pages in the buffer pool
+  static std::atomic<int> flushCount;  // total # of writes of dirty pages
+};
 
-  static int cacheClock; // clock tick counter for LRU policy
+/**
+ * a handle to a page pinned in the buffer pool.
+ * the handle gives direct access to the cached page without copying it,
+ * and unpins the page when it is released or destroyed.
+ */
+class PinnedPage {
+ public:
+  PinnedPage();
+  ~PinnedPage();
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  /**
+   * pin a page for reading. a page held by this handle is released first.
+   * @param pf[IN] the PageFile that contains the page
+   * @param pid[IN] the page to pin
+   * @return error code. 0 if no error
+   */
+  RC pin(const PageFile& pf, PageId pid);
+
+  /**
+   * pin a page for writing. a page held by this handle is released first.
+   * @param pf[IN] the PageFile that contains the page
+   * @param pid[IN] the page to pin. it may be >= pf.endPid()
+   * @return error code. 0 if no error
+   */
+  RC pinForWrite(PageFile& pf, PageId pid);
+
+  /**
+   * write back the modifications made through writableData().
+   * @return error code. 0 if no error
+   */
+  RC markDirty();
+
+  /**
+   * unpin the page. does nothing if no page is pinned.
+   * @return error code. 0 if no error
+   */
+  RC release();
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  /**
+   * @return the pinned page, or NULL if no page is pinned
+   */
+  const char* data() const { return page; }
+
+  /**
+   * @return the pinned page, if it was pinned by pinForWrite()
+   */
+  char* writableData() { return wpf ? const_cast<char*>(page) : NULL; }
+
+  /**
+   * @return the id of the pinned page
+   */
+  PageId pageId() const { return pid; }
+
+ private:
+  // a pinned page cannot be copied
+  PinnedPage(const PinnedPage&);
+  PinnedPage& operator=(const PinnedPage&);
+
+  const PageFile* pf;   // the PageFile of the pinned page (NULL if none)
+  PageFile*       wpf;  // pf, if the page was pinned for writing
+  PageId          pid;  // the pinned page
+  const char*     page; // the cached page in the buffer pool
 };
-  
+
 #endif // PAGEFILE_H
@@ -7,23 +7,76 @@
  * @date 3/24/2008
  */
 
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "RecordFile.h"
 
 using std::string;
 
+int RecordFile::defaultFormat = RecordFile::FORMAT_SLOTTED;
+
+//
+// The page formats.
+//
+// Both formats store # records in the page in the first four bytes of
+// the page, and a record is a key (an int) followed by its value as a
+// null-terminated string.
+//
+// FORMAT_FIXED: the records follow the count in slots of a fixed size,
+// sizeof(int) + MAX_VALUE_LENGTH bytes, whatever the length of the value.
+//
+// FORMAT_SLOTTED: the count is followed by the offset where the records
+// start (0 in a page that was never written, which stands for the end of
+// the page) and the slot directory, which holds the offset of the n'th
+// record of the page in its n'th entry. the records are stored from the
+// end of the page towards the directory, each taking only as much space
+// as its value needs.
+//
+//   | count | heap | slot 0 | slot 1 | ... free space ... | record 1 | record 0 |
+//
+// a value of VALUE_PREFIX_LENGTH characters or more is stored as its
+// first VALUE_PREFIX_LENGTH characters (the prefix), the NUL, and an
+// OverflowRef to the rest of the value. a shorter value never has that
+// many characters, so the length of the prefix tells an overflowed value.
+// the rest of the value is stored in the overflow file of the table, in
+// pages that start with the # of bytes used in the page; a value that
+// does not fit in the last page continues in the next one.
+//
+//   | used | the rest of a value | the rest of another value ... |
+//
+static const int SLOTTED_HEADER = 2 * sizeof(int);     // count and heap
+static const int SLOT_SIZE = sizeof(unsigned short);   // a directory entry
+static const int OVERFLOW_HEADER = sizeof(int);        // used
+
+// the location of the rest of an overflowed value
+struct OverflowRef {
+  PageId pid;     // the overflow page where the rest starts (-1 if none)
+  int    offset;  // the offset of the rest in the page
+  int    length;  // the length of the whole value
+};
+
+// the suffix of the name of the overflow file of a RecordFile
+static const char OVERFLOW_SUFFIX[] = ".ovf";
+
 //
 // helper functions for page manipultation
 //
 
-// compute the pointer to the n'th slot in a page
-static char* slotPtr(char* page, int n);
+// compute the pointer to the n'th record in a page
+static const char* recordPtr(const char* page, int format, int n);
+
+// read count records starting from the n'th slot in place
+static void readSlots(const char* page, int format, int n, int count, int* keys, const char** values);
 
-// read the record in the n'th slot in the page
-static void readSlot(const char* page, int n, int& key, std::string& value);
+// check whether the n'th record with the value fits in the page
+static bool hasRoom(const char* page, int format, int pageSize, int n, const std::string& value);
 
-// write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, int key, const std::string& value);
+// write the record to the n'th slot in the page. ref is the location of
+// the rest of an overflowed value
+static void writeSlot(char* page, int format, int pageSize, int n, int key,
+                      const std::string& value, const OverflowRef& ref);
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
@@ -36,32 +89,6 @@ static void setRecordCount(char* page, int count);
 // helper functions for RecordId manipulation
 //
 
-// postfix record id iterator
-RecordId operator++ (RecordId& rid, int)
-{
-  RecordId prid(rid);
-
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  }
-
-  return prid;
-}
-
-// prefix record id iterator
-RecordId& operator++ (RecordId& rid)
-{
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  } 
-
-  return rid;
-}
-
 // RecordId comparators
 bool operator < (const RecordId& r1, const RecordId& r2)
 {
@@ -106,20 +133,73 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  recordsPerPage = 0;
+  format = FORMAT_FIXED;
+  ovfOpen = false;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  erid.pid = 0;
+  erid.sid = 0;
+  recordsPerPage = 0;
+  format = FORMAT_FIXED;
+  ovfOpen = false;
   open(filename, mode);
 }
 
+// compute the (maximum) number of records in a page of the given size.
+// Note that we subtract the page header from the page size: the first
+// four bytes in the page are used to store # records in the page.
+static int slotsPerPage(int format, int pageSize)
+{
+  if (format == RecordFile::FORMAT_SLOTTED) {
+    // a record with an empty value takes a directory entry, a key and a NUL
+    return (pageSize - SLOTTED_HEADER) / (SLOT_SIZE + sizeof(int) + 1);
+  }
+  return (pageSize - sizeof(int)) / (sizeof(int) + RecordFile::MAX_VALUE_LENGTH);
+}
+
+RC RecordFile::setDefaultFormat(int format)
+{
+  if (format != FORMAT_FIXED && format != FORMAT_SLOTTED) return RC_INVALID_FILE_FORMAT;
+  defaultFormat = format;
+  return 0;
+}
+
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PinnedPage page;
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  // an empty file opened for writing gets the default format. a file
+  // without a header (or whose header cannot be written) keeps FORMAT_FIXED
+  format = pf.getFormat();
+  if (pf.endPid() == 0 && format != defaultFormat && (mode == 'w' || mode == 'W')) {
+    if (pf.setFormat(defaultFormat) == 0) format = defaultFormat;
+  }
+  if (format != FORMAT_FIXED && format != FORMAT_SLOTTED) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // the capacity of a page depends on the format and page size of the file
+  recordsPerPage = slotsPerPage(format, pf.getPageSize());
+
+  // the overflow file is opened if it exists. otherwise it is created
+  // when the first long value is appended
+  ovfName = filename + OVERFLOW_SUFFIX;
+  ovfMode = mode;
+  if (format == FORMAT_SLOTTED && ::access(ovfName.c_str(), F_OK) == 0) {
+    if ((rc = ovf.open(ovfName, mode)) < 0) {
+      pf.close();
+      return rc;
+    }
+    ovfOpen = true;
+  }
   
   //
   // in the rest of this function, we set the end record id
@@ -138,90 +218,378 @@ RC RecordFile::open(const string& filename, char mode)
   // obtain # records in the last page to set sid of the end record id.
   // read the last page of the file and get # records in the page.
   // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
+  if ((rc = page.pin(pf, --erid.pid)) < 0) {
     // an error occurred during page read
     erid.pid = erid.sid = 0;
     pf.close();
+    if (ovfOpen) ovf.close();
+    ovfOpen = false;
     return rc;
   }
 
-  // get # records in the last page
-  erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
-    // the last page is full. advance the end record id to the next page.
-    erid.pid++;
-    erid.sid = 0;
-  }
+  // get # records in the last page. the end record id stays in the last
+  // page even if it is full; append() moves on when a record does not fit
+  erid.sid = getRecordCount(page.data());
+  page.release();
   
   return 0;
 }
 
 RC RecordFile::close()
 {
+  RC rc = flush();
+
   erid.pid = 0;
   erid.sid = 0;
 
-  return pf.close();
+  RC closed = pf.close();
+  if (rc == 0) rc = closed;
+  if (ovfOpen) {
+    closed = ovf.close();
+    if (rc == 0) rc = closed;
+    ovfOpen = false;
+  }
+  return rc;
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PinnedPage page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= recordsPerPage) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record in the buffer pool
+  if ((rc = page.pin(pf, rid.pid)) < 0) return rc;
+  if (rid.sid >= getRecordCount(page.data())) return RC_INVALID_RID;
+
+  // read the record directly from the slot in the cached page,
+  // and the rest of the value from the overflow pages
+  const char* ptr = recordPtr(page.data(), format, rid.sid);
+  memcpy(&key, ptr, sizeof(int));
+  if ((rc = readValue(ptr + sizeof(int), value)) < 0) return rc;
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  return page.release();
+}
 
+RC RecordFile::read(const RecordId& rid, int& key, const char*& value, PinnedPage& page) const
+{
+  RC   rc;
+  const char* ptr;
+
+  // check whether the rid is in the valid range
+  if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= recordsPerPage) return RC_INVALID_RID;
+  if (rid >= erid) return RC_INVALID_RID;
+
+  // pin the page containing the record, unless it is pinned already
+  if (page.data() == NULL || page.pageId() != rid.pid) {
+    if ((rc = page.pin(pf, rid.pid)) < 0) return rc;
+  }
+  if (rid.sid >= getRecordCount(page.data())) return RC_INVALID_RID;
+
+  // read the key and point the value into the record
+  ptr = recordPtr(page.data(), format, rid.sid);
+  memcpy(&key, ptr, sizeof(int));
+  value = ptr + sizeof(int);
   return 0;
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PinnedPage page;
+  OverflowRef ref;
 
-  // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
-  if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
-  } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+  // store the rest of a long value in the overflow file first
+  if ((rc = writeOverflow(value, ref.pid, ref.offset, ref.length)) < 0) return rc;
+
+  // pin the last page in the buffer pool. if we are writing to the
+  // first slot of an empty page, the pinned page is initialized with zeros
+  if ((rc = page.pinForWrite(pf, erid.pid)) < 0) return rc;
+
+  // if the record does not fit in the last page, start a new page
+  if (!hasRoom(page.data(), format, pf.getPageSize(), erid.sid, value)) {
+    erid.pid++;
+    erid.sid = 0;
+    if ((rc = page.pinForWrite(pf, erid.pid)) < 0) return rc;
   }
     
   // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
+  writeSlot(page.writableData(), format, pf.getPageSize(), erid.sid, key, value, ref);
 
   // the first four bytes in the page stores # records in the page.
   // update this number.
-  setRecordCount(page, erid.sid + 1);
+  setRecordCount(page.writableData(), erid.sid + 1);
 
   // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  if ((rc = page.markDirty()) < 0) return rc;
+  page.release();
     
   // we need to output the rid of the record slot
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  erid.sid++;
+
+  return 0;
+}
+
+RC RecordFile::bufferedAppend(int key, const std::string& value, RecordId& rid)
+{
+  RC   rc;
+  OverflowRef ref;
+
+  // store the rest of a long value in the overflow file first
+  if ((rc = writeOverflow(value, ref.pid, ref.offset, ref.length)) < 0) return rc;
 
+  // pin the last page for the records to come, unless it is pinned already
+  // (append() may have moved the end of the file to another page)
+  if (tail.data() == NULL || tail.pageId() != erid.pid) {
+    if ((rc = flush()) < 0) return rc;
+    if ((rc = tail.pinForWrite(pf, erid.pid)) < 0) return rc;
+  }
+
+  // write the page once it is full, and continue in a new page
+  if (!hasRoom(tail.data(), format, pf.getPageSize(), erid.sid, value)) {
+    if ((rc = flush()) < 0) return rc;
+    erid.pid++;
+    erid.sid = 0;
+    if ((rc = tail.pinForWrite(pf, erid.pid)) < 0) return rc;
+  }
+
+  // write the record to the first empty slot, and update # records
+  writeSlot(tail.writableData(), format, pf.getPageSize(), erid.sid, key, value, ref);
+  setRecordCount(tail.writableData(), erid.sid + 1);
+
+  rid = erid;
+  erid.sid++;
   return 0;
 }
 
+RC RecordFile::flush()
+{
+  RC   rc;
+
+  if (tail.data() == NULL) return 0;
+  rc = tail.markDirty();
+  tail.release();
+  return rc;
+}
+
+RC RecordFile::writeOverflow(const std::string& value, PageId& pid, int& offset, int& length)
+{
+  RC   rc;
+  PinnedPage page;
+  int  pageSize, used, left;
+  const char* data;
+
+  pid = -1;
+  offset = 0;
+  length = strlen(value.c_str());
+  if (format != FORMAT_SLOTTED || length < VALUE_PREFIX_LENGTH) return 0;
+
+  // the part of the value after the prefix
+  data = value.c_str() + VALUE_PREFIX_LENGTH;
+  left = length - VALUE_PREFIX_LENGTH;
+  if (left == 0) return 0;
+
+  if (!ovfOpen) {
+    if ((rc = ovf.open(ovfName, ovfMode)) < 0) return rc;
+    ovfOpen = true;
+  }
+  pageSize = ovf.getPageSize();
+
+  // continue in the last page of the overflow file, or in a new page if
+  // it is full. a page that was never written is all zeros
+  PageId last = (ovf.endPid() > 0) ? ovf.endPid() - 1 : 0;
+  if ((rc = page.pinForWrite(ovf, last)) < 0) return rc;
+  memcpy(&used, page.data(), sizeof(int));
+  if (used == 0) used = OVERFLOW_HEADER;
+  if (used == pageSize) {
+    used = OVERFLOW_HEADER;
+    if ((rc = page.pinForWrite(ovf, ++last)) < 0) return rc;
+  }
+  pid = last;
+  offset = used;
+
+  // fill the pages one after the other
+  while (true) {
+    int n = (left < pageSize - used) ? left : pageSize - used;
+    memcpy(page.writableData() + used, data, n);
+    used += n;
+    memcpy(page.writableData(), &used, sizeof(int));
+    if ((rc = page.markDirty()) < 0) return rc;
+
+    data += n;
+    left -= n;
+    if (left == 0) return 0;
+
+    used = OVERFLOW_HEADER;
+    if ((rc = page.pinForWrite(ovf, ++last)) < 0) return rc;
+  }
+}
+
+bool RecordFile::isOverflowed(const char* value) const
+{
+  return format == FORMAT_SLOTTED && strnlen(value, VALUE_PREFIX_LENGTH) == VALUE_PREFIX_LENGTH;
+}
+
+int RecordFile::getValueLength(const char* value) const
+{
+  OverflowRef ref;
+
+  if (!isOverflowed(value)) return strlen(value);
+  memcpy(&ref, value + VALUE_PREFIX_LENGTH + 1, sizeof(ref));
+  return ref.length;
+}
+
+RC RecordFile::readValue(const char* value, std::string& whole) const
+{
+  RC   rc;
+  PinnedPage page;
+  OverflowRef ref;
+
+  whole.assign(value);
+  if (!isOverflowed(value)) return 0;
+
+  // the rest of the value follows the prefix from the referenced page on
+  memcpy(&ref, value + VALUE_PREFIX_LENGTH + 1, sizeof(ref));
+  if (ref.length < VALUE_PREFIX_LENGTH) return RC_INVALID_FILE_FORMAT;
+  if (ref.length == VALUE_PREFIX_LENGTH) return 0;
+  if (!ovfOpen) return RC_FILE_OPEN_FAILED;
+
+  int left = ref.length - VALUE_PREFIX_LENGTH;
+  int pageSize = ovf.getPageSize();
+  whole.reserve(ref.length);
+  for (PageId pid = ref.pid, offset = ref.offset; left > 0; pid++, offset = OVERFLOW_HEADER) {
+    if (offset < OVERFLOW_HEADER || offset >= pageSize) return RC_INVALID_FILE_FORMAT;
+    if ((rc = page.pin(ovf, pid)) < 0) return rc;
+    int n = (left < pageSize - offset) ? left : pageSize - offset;
+    whole.append(page.data() + offset, n);
+    left -= n;
+  }
+  return 0;
+}
+
+RC RecordFile::setAccessPattern(int pattern) const
+{
+  return pf.setAccessPattern(pattern);
+}
+
+RC RecordFile::prefetch(PageId pid, int count) const
+{
+  return pf.prefetch(pid, count);
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+RecordCursor::RecordCursor()
+{
+  rf = NULL;
+  cur.pid = cur.sid = 0;
+  readAhead = 0;
+  ahead = 0;
+}
+
+RC RecordCursor::open(const RecordFile& file, int pages)
+{
+  close();
+  rf = &file;
+  cur.pid = cur.sid = 0;
+  readAhead = pages;
+  ahead = 0;
+  return 0;
+}
+
+RC RecordCursor::seek(PageId pid)
+{
+  if (rf == NULL) return RC_INVALID_CURSOR;
+  if (pid < 0) return RC_INVALID_PID;
+  cur.pid = pid;
+  cur.sid = 0;
+  ahead = 0;
+  return 0;
+}
+
+RC RecordCursor::pinCurrent()
+{
+  RC   rc;
+
+  while (true) {
+    // check whether the end of the file is reached
+    if (cur >= rf->erid) {
+      page.release();
+      return RC_NO_SUCH_RECORD;
+    }
+
+    // pin the page of the record, unless it is pinned already.
+    // keep the next pages in flight while this one is being scanned:
+    // the whole window is requested for the first page, and only the
+    // page that enters the window for every page after it.
+    if (page.data() == NULL || page.pageId() != cur.pid) {
+      if (readAhead > 0 && ahead < cur.pid + 1 + readAhead) {
+        PageId first = std::max(ahead, cur.pid + 1);
+        ahead = cur.pid + 1 + readAhead;
+        rf->pf.prefetch(first, ahead - first);
+      }
+      if ((rc = page.pin(rf->pf, cur.pid)) < 0) return rc;
+    }
+
+    // move to the next page after the last record of the page
+    if (cur.sid < getRecordCount(page.data())) return 0;
+    cur.pid++;
+    cur.sid = 0;
+  }
+}
+
+RC RecordCursor::next(RecordId& rid, int& key, const char*& value)
+{
+  RC   rc;
+  const char* ptr;
+
+  if (rf == NULL) return RC_INVALID_CURSOR;
+  if ((rc = pinCurrent()) < 0) return rc;
+
+  // read the key and point the value into the record
+  ptr = recordPtr(page.data(), rf->format, cur.sid);
+  memcpy(&key, ptr, sizeof(int));
+  value = ptr + sizeof(int);
+
+  rid = cur;
+  cur.sid++;
+  return 0;
+}
+
+RC RecordCursor::nextPage(RecordId& rid, int* keys, const char** values, int& count)
+{
+  RC   rc;
+
+  if (rf == NULL) return RC_INVALID_CURSOR;
+  if ((rc = pinCurrent()) < 0) return rc;
+
+  // the records from the cursor to the end of the page
+  count = getRecordCount(page.data()) - cur.sid;
+  readSlots(page.data(), rf->format, cur.sid, count, keys, values);
+
+  rid = cur;
+  cur.pid++;
+  cur.sid = 0;
+  return 0;
+}
+
+void RecordCursor::close()
+{
+  page.release();
+  rf = NULL;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -237,8 +605,26 @@ static void setRecordCount(char* page, int count)
   memcpy(page, &count, sizeof(int));
 }
 
-static char* slotPtr(char* page, int n) 
+static int getHeap(const char* page, int pageSize)
 {
+  int heap;
+
+  // the second four bytes of a slotted page contain the offset of the
+  // records. a page that has no record yet is all zeros
+  memcpy(&heap, page + sizeof(int), sizeof(int));
+  return (heap == 0) ? pageSize : heap;
+}
+
+static const char* recordPtr(const char* page, int format, int n)
+{
+  unsigned short offset;
+
+  if (format == RecordFile::FORMAT_SLOTTED) {
+    // the n'th entry of the slot directory has the offset of the record
+    memcpy(&offset, page + SLOTTED_HEADER + SLOT_SIZE * n, SLOT_SIZE);
+    return page + offset;
+  }
+
   // compute the location of the n'th slot in a page.
   // remember that the first four bytes in a page is used to store
   // # records in the page and each slot consists of an integer and
@@ -246,32 +632,79 @@ static char* slotPtr(char* page, int n)
   return (page+sizeof(int)) + (sizeof(int)+RecordFile::MAX_VALUE_LENGTH)*n;
 }
 
-static void readSlot(const char* page, int n, int& key, std::string& value)
+static void readSlots(const char* page, int format, int n, int count, int* keys, const char** values)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(const_cast<char*>(page), n);
+  const char* ptr;
+
+  if (format == RecordFile::FORMAT_SLOTTED) {
+    const char* slot = page + SLOTTED_HEADER + SLOT_SIZE * n;
+    for (int i = 0; i < count; i++, slot += SLOT_SIZE) {
+      unsigned short offset;
+      memcpy(&offset, slot, SLOT_SIZE);
+      memcpy(&keys[i], page + offset, sizeof(int));
+      values[i] = page + offset + sizeof(int);
+    }
+    return;
+  }
 
-  // read the key 
-  memcpy(&key, ptr, sizeof(int));
+  ptr = recordPtr(page, format, n);
+  for (int i = 0; i < count; i++, ptr += sizeof(int) + RecordFile::MAX_VALUE_LENGTH) {
+    memcpy(&keys[i], ptr, sizeof(int));
+    values[i] = ptr + sizeof(int);
+  }
+}
+
+// the # of characters of the value that are stored in the record.
+// a value is cut at its first NUL. longer values are truncated, or with
+// FORMAT_SLOTTED, continue in the overflow pages
+static int storedLength(const std::string& value)
+{
+  return strnlen(value.c_str(), RecordFile::VALUE_PREFIX_LENGTH);
+}
+
+// the size of a record of the slotted format
+static int recordSize(const std::string& value)
+{
+  int length = storedLength(value);
+  int size = sizeof(int) + length + 1;
+  return (length == RecordFile::VALUE_PREFIX_LENGTH) ? size + sizeof(OverflowRef) : size;
+}
 
-  // read the value
-  value.assign(ptr + sizeof(int));
+static bool hasRoom(const char* page, int format, int pageSize, int n, const std::string& value)
+{
+  if (format == RecordFile::FORMAT_SLOTTED) {
+    int free = getHeap(page, pageSize) - (SLOTTED_HEADER + SLOT_SIZE * (n + 1));
+    return free >= recordSize(value);
+  }
+  return n < slotsPerPage(format, pageSize);
 }
 
-static void writeSlot(char* page, int n, int key, const std::string& value)
+static void writeSlot(char* page, int format, int pageSize, int n, int key,
+                      const std::string& value, const OverflowRef& ref)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(page, n);
+  int length = storedLength(value);
+  char *ptr;
+
+  if (format == RecordFile::FORMAT_SLOTTED) {
+    // put the record right below the previous one, and point the slot to it
+    int heap = getHeap(page, pageSize) - recordSize(value);
+    unsigned short offset = heap;
+    memcpy(page + sizeof(int), &heap, sizeof(int));
+    memcpy(page + SLOTTED_HEADER + SLOT_SIZE * n, &offset, SLOT_SIZE);
+    ptr = page + heap;
+  } else {
+    // compute the location of the record
+    ptr = const_cast<char*>(recordPtr(page, format, n));
+  }
 
   // store the key
   memcpy(ptr, &key, sizeof(int));
 
-  // store the value. 
-  if ((int)value.size() >= RecordFile::MAX_VALUE_LENGTH) {
-    // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH -1);
-    *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
-  } else {
-    strcpy(ptr + sizeof(int), value.c_str());
+  // store the value. when the string is longer than MAX_VALUE_LENGTH,
+  // it is truncated, or its prefix is followed by the overflow reference.
+  memcpy(ptr + sizeof(int), value.c_str(), length);
+  *(ptr + sizeof(int) + length) = 0;
+  if (format == RecordFile::FORMAT_SLOTTED && length == RecordFile::VALUE_PREFIX_LENGTH) {
+    memcpy(ptr + sizeof(int) + length + 1, &ref, sizeof(ref));
   }
 }
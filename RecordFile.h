@@ -26,10 +26,6 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
-RecordId& operator++ (RecordId& rid);
-RecordId  operator++ (RecordId& rid, int);
-
 // RecordId comparators
 bool operator> (const RecordId& r1, const RecordId& r2);
 bool operator< (const RecordId& r1, const RecordId& r2);
@@ -39,25 +35,46 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * read/write a record to a file.
+ * a file stores its records in one of two page formats: FORMAT_FIXED
+ * gives every record a slot of MAX_VALUE_LENGTH bytes for its value, and
+ * FORMAT_SLOTTED stores records of variable length behind a directory of
+ * slots, so that many more short records fit in a page. in both formats
+ * a record is identified by its page and its slot in the page.
+ * with FORMAT_SLOTTED, a value of VALUE_PREFIX_LENGTH characters or more
+ * keeps only its prefix in the record, and the rest of it is stored in
+ * the overflow file of the table (the file name followed by ".ovf").
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
+  // maximum length of the value field in a record. a longer value is
+  // truncated with FORMAT_FIXED, and continues in overflow pages with
+  // FORMAT_SLOTTED
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
-    // four bytes in the page is used to store # records in the page.
+  // the # of characters of an overflowed value kept in its record
+  static const int VALUE_PREFIX_LENGTH = MAX_VALUE_LENGTH - 1;
+
+  // the page formats of a file
+  static const int FORMAT_FIXED   = 0;  // fixed-size slots (older files)
+  static const int FORMAT_SLOTTED = 1;  // a slot directory and variable-length records
 
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
+  /**
+   * set the page format of the files created from now on.
+   * files that already have records keep their format.
+   * @param format[IN] FORMAT_FIXED or FORMAT_SLOTTED (the default)
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultFormat(int format);
+
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the format set by setDefaultFormat().
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
    * @return error code. 0 if no error
@@ -66,6 +83,7 @@ class RecordFile {
 
   /**
    * close the file.
+   * the page held by bufferedAppend() is written first.
    * @return error code. 0 if no error
    */
   RC close();
@@ -79,6 +97,21 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a record in place through a pinned page.
+   * only the prefix of an overflowed value is in the page: see readValue().
+   * the page of the record is pinned in page unless page holds it already,
+   * so reading records in rid order pins every page only once.
+   * value points into the pinned page, and stays valid until page is
+   * released or pins another page.
+   * @param rid[IN] the id of the record to read
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value (a null-terminated string)
+   * @param page[IN/OUT] the page pinned by the previous read, if any
+   * @return error code. 0 if no error
+   */
+  RC read(const RecordId& rid, int& key, const char*& value, PinnedPage& page) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -90,15 +123,172 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append a new record at the end of the file, without writing its page
+   * right away. the last page is kept pinned and filled in memory, and
+   * it is written once, when it is full or when flush() or close() is
+   * called. so a page of records costs one page write, instead of one
+   * page write (and read) per record.
+   * the record can be read from this RecordFile right away.
+   * @param key[IN] the record key
+   * @param value[IN] the record value
+   * @param rid[OUT] the location of the stored record
+   * @return error code. 0 if no error
+   */
+  RC bufferedAppend(int key, const std::string& value, RecordId& rid);
+
+  /**
+   * write the page held by bufferedAppend() to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * check whether a value read in place (by read() or a RecordCursor)
+   * is the prefix of a longer value that continues in overflow pages.
+   * @param value[IN] the value in the page
+   * @return true if the rest of the value is in the overflow file
+   */
+  bool isOverflowed(const char* value) const;
+
+  /**
+   * @param value[IN] a value read in place
+   * @return the length of the whole value. no overflow page is read
+   */
+  int getValueLength(const char* value) const;
+
+  /**
+   * read the whole of a value read in place, including the part in the
+   * overflow pages. only an overflowed value reads overflow pages.
+   * @param value[IN] the value in the page
+   * @param whole[OUT] the whole value
+   * @return error code. 0 if no error
+   */
+  RC readValue(const char* value, std::string& whole) const;
+
+  /**
+   * tell the underlying PageFile how the records will be accessed.
+   * @param pattern[IN] PageFile::ACCESS_SEQUENTIAL for a table scan,
+   * PageFile::ACCESS_RANDOM for fetching records found through an index
+   * @return error code. 0 if no error
+   */
+  RC setAccessPattern(int pattern) const;
+
+  /**
+   * start reading pages of the file in the background.
+   * see PageFile::prefetch().
+   * @param pid[IN] the first page to read ahead
+   * @param count[IN] the number of pages to read ahead
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const;
+
+  /**
+   * @return the maximum number of records in a page of the file.
+   * with FORMAT_SLOTTED, the number of records in a page depends on the
+   * lengths of their values
+   */
+  int getRecordsPerPage() const { return recordsPerPage; }
+
+  /**
+   * @return the page format of the file (FORMAT_FIXED or FORMAT_SLOTTED)
+   */
+  int getFormat() const { return format; }
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
+   * the end record id is always in the last page of the file, so its
+   * sid is the number of records in the last page.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
  private:
+  friend class RecordCursor;
+
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int recordsPerPage;  // maximum number of records per page
+  int format;      // the page format of the file
+  PinnedPage tail; // the last page, while bufferedAppend() fills it
+
+  PageFile ovf;    // the overflow file, holding the rest of the long values
+  bool ovfOpen;    // whether ovf is open
+  std::string ovfName;  // the name of the overflow file
+  char ovfMode;    // the mode to open the overflow file in
+
+  // write the part of a long value after its prefix to the overflow file.
+  // pid is set to -1 if nothing is written
+  RC writeOverflow(const std::string& value, PageId& pid, int& offset, int& length);
+
+  static int defaultFormat;  // the page format of newly created files
+};
+
+/**
+ * a cursor that scans the records of a RecordFile in rid order.
+ * the cursor pins one page at a time and returns the records of the page
+ * in place, so that neither the page nor the values are copied.
+ */
+class RecordCursor {
+ public:
+  RecordCursor();
+
+  /**
+   * start a scan from the first record of a RecordFile.
+   * the RecordFile must stay open until the cursor is closed.
+   * @param rf[IN] the RecordFile to scan
+   * @param readAhead[IN] # of pages to read ahead of the scan (0 for none)
+   * @return error code. 0 if no error
+   */
+  RC open(const RecordFile& rf, int readAhead = 0);
+
+  /**
+   * move the cursor to the first record of a page, so that a part of
+   * the file can be scanned (e.g., by one of several scan threads).
+   * @param pid[IN] the page to continue the scan from
+   * @return error code. 0 if no error
+   */
+  RC seek(PageId pid);
+
+  /**
+   * read the next record.
+   * value points into the pinned page, and stays valid until the next
+   * call to next() or close().
+   * @param rid[OUT] the id of the record
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value (a null-terminated string)
+   * @return error code. RC_NO_SUCH_RECORD at the end of the file
+   */
+  RC next(RecordId& rid, int& key, const char*& value);
+
+  /**
+   * read the rest of the records in the current page at once, and move
+   * to the next page. the keys are copied into an array, and the values
+   * point into the pinned page, valid until the next call to next(),
+   * nextPage() or close().
+   * @param rid[OUT] the id of the first record read
+   * @param keys[OUT] the record keys. must hold getRecordsPerPage() entries
+   * @param values[OUT] the record values. must hold getRecordsPerPage() entries
+   * @param count[OUT] the number of records read
+   * @return error code. RC_NO_SUCH_RECORD at the end of the file
+   */
+  RC nextPage(RecordId& rid, int* keys, const char** values, int& count);
+
+  /**
+   * end the scan and unpin the current page.
+   */
+  void close();
+
+ private:
+  // pin the page of the next record, skipping to the next page after the
+  // last record of a page
+  RC pinCurrent();
+
+  const RecordFile* rf;  // the RecordFile being scanned (NULL if closed)
+  PinnedPage page;       // the page of the current record
+  RecordId   cur;        // the id of the next record to return
+  int        readAhead;  // # of pages to read ahead of the scan
+  PageId     ahead;      // the first page not requested from the read-ahead
 };
 
 #endif // RECORDFILE_H
@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "ScanFilter.h"
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+using namespace std;
+
+/*
+ * whether a comparison result (value - condition value) meets a comparator
+ */
+template <SelCond::Comparator C>
+static inline bool satisfies(int diff)
+{
+  switch (C) {
+  case SelCond::EQ: return diff == 0;
+  case SelCond::NE: return diff != 0;
+  case SelCond::LT: return diff < 0;
+  case SelCond::GT: return diff > 0;
+  case SelCond::LE: return diff <= 0;
+  case SelCond::GE: return diff >= 0;
+  }
+  return false;
+}
+
+/*
+ * compare a value read in place with a condition value of at least
+ * VALUE_PREFIX_LENGTH characters, given diff, the result of comparing the
+ * value as it is in the page. diff is final unless the value is the
+ * prefix of an overflowed value and the condition value starts with it.
+ * a value that cannot be read is compared by its prefix.
+ */
+static int compareWhole(const RecordFile& rf, const char* value, const char* cond, int diff)
+{
+  const int prefix = RecordFile::VALUE_PREFIX_LENGTH;
+  string whole;
+
+  if (diff > 0 || !rf.isOverflowed(value) || strncmp(value, cond, prefix) != 0) return diff;
+
+  // the lengths decide if either value is just the prefix
+  int length = rf.getValueLength(value);
+  if (cond[prefix] == '\0') return length > prefix;
+  if (length == prefix) return -1;
+
+  if (rf.readValue(value, whole) < 0) return diff;
+  return strcmp(whole.c_str(), cond);
+}
+
+/*
+ * keep the selected positions whose value meets the condition.
+ * the comparator is a template argument, so the loop does not branch on it.
+ * rf is NULL unless the condition value is long enough to need the
+ * overflow pages (see compareWhole()).
+ */
+template <SelCond::Comparator C>
+static int narrow(const char* const* values, const char* cond, const RecordFile* rf, int* sel, int n)
+{
+  int m = 0;
+  for (int k = 0; k < n; k++) {
+    int diff = strcmp(values[sel[k]], cond);
+    if (rf != NULL && diff <= 0) diff = compareWhole(*rf, values[sel[k]], cond, diff);
+    sel[m] = sel[k];
+    m += satisfies<C>(diff);
+  }
+  return m;
+}
+
+ScanFilter::ScanFilter(const vector<SelCond>& cond, const RecordFile* table)
+{
+  rf = table;
+
+  if (!keyRange(cond, lo, hi)) {
+    lo = 1;
+    hi = 0;
+  }
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1) {
+      // only the excluded keys inside the interval matter
+      int v = atoi(cond[i].value);
+      if (cond[i].comp == SelCond::NE && v >= lo && v <= hi &&
+          find(excluded.begin(), excluded.end(), v) == excluded.end())
+        excluded.push_back(v);
+    } else {
+      ValueCond vc;
+      vc.comp = cond[i].comp;
+      vc.value = cond[i].value;
+      vc.prefixed = (rf != NULL && vc.value.size() >= (size_t) RecordFile::VALUE_PREFIX_LENGTH);
+      valueConds.push_back(vc);
+    }
+  }
+}
+
+bool ScanFilter::keyRange(const vector<SelCond>& cond, int& lo, int& hi)
+{
+  lo = INT_MIN;
+  hi = INT_MAX;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) continue;
+    int v = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      lo = max(lo, v);
+      hi = min(hi, v);
+      break;
+    case SelCond::GT:
+      if (v == INT_MAX) return false;
+      lo = max(lo, v + 1);
+      break;
+    case SelCond::GE:
+      lo = max(lo, v);
+      break;
+    case SelCond::LT:
+      if (v == INT_MIN) return false;
+      hi = min(hi, v - 1);
+      break;
+    case SelCond::LE:
+      hi = min(hi, v);
+      break;
+    default:
+      break;
+    }
+  }
+  return lo <= hi;
+}
+
+bool ScanFilter::matchKey(int key) const
+{
+  if (key < lo || key > hi) return false;
+  for (unsigned j = 0; j < excluded.size(); j++)
+    if (key == excluded[j]) return false;
+  return true;
+}
+
+bool ScanFilter::matchValue(const char* value) const
+{
+  for (unsigned j = 0; j < valueConds.size(); j++) {
+    int diff = strcmp(value, valueConds[j].value.c_str());
+    if (valueConds[j].prefixed) diff = compareWhole(*rf, value, valueConds[j].value.c_str(), diff);
+    switch (valueConds[j].comp) {
+    case SelCond::EQ: if (!satisfies<SelCond::EQ>(diff)) return false; break;
+    case SelCond::NE: if (!satisfies<SelCond::NE>(diff)) return false; break;
+    case SelCond::LT: if (!satisfies<SelCond::LT>(diff)) return false; break;
+    case SelCond::GT: if (!satisfies<SelCond::GT>(diff)) return false; break;
+    case SelCond::LE: if (!satisfies<SelCond::LE>(diff)) return false; break;
+    case SelCond::GE: if (!satisfies<SelCond::GE>(diff)) return false; break;
+    }
+  }
+  return true;
+}
+
+int ScanFilter::filter(const int* keys, const char* const* values, int count, int* sel) const
+{
+  int n = 0;
+
+  if (isEmpty()) return 0;
+
+  // the key interval. key - lo wraps around for keys below lo, so one
+  // unsigned comparison tests both ends, and every position is written
+  // without a branch
+  unsigned width = (unsigned) hi - (unsigned) lo;
+  for (int i = 0; i < count; i++) {
+    sel[n] = i;
+    n += ((unsigned) keys[i] - (unsigned) lo <= width);
+  }
+
+  // the excluded keys
+  for (unsigned j = 0; j < excluded.size(); j++) {
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+      sel[m] = sel[k];
+      m += (keys[sel[k]] != excluded[j]);
+    }
+    n = m;
+  }
+
+  // the conditions on the value, for the tuples that are left
+  for (unsigned j = 0; j < valueConds.size() && n > 0; j++) {
+    const char* v = valueConds[j].value.c_str();
+    const RecordFile* table = valueConds[j].prefixed ? rf : NULL;
+    switch (valueConds[j].comp) {
+    case SelCond::EQ: n = narrow<SelCond::EQ>(values, v, table, sel, n); break;
+    case SelCond::NE: n = narrow<SelCond::NE>(values, v, table, sel, n); break;
+    case SelCond::LT: n = narrow<SelCond::LT>(values, v, table, sel, n); break;
+    case SelCond::GT: n = narrow<SelCond::GT>(values, v, table, sel, n); break;
+    case SelCond::LE: n = narrow<SelCond::LE>(values, v, table, sel, n); break;
+    case SelCond::GE: n = narrow<SelCond::GE>(values, v, table, sel, n); break;
+    }
+  }
+  return n;
+}
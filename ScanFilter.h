@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef SCANFILTER_H
+#define SCANFILTER_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "SqlEngine.h"
+
+/**
+ * The conditions of a SELECT, compiled once per query into typed
+ * predicates that are evaluated over a page of tuples at a time.
+ *
+ * The conditions on the key are intersected into an interval [lo, hi]
+ * and a list of excluded keys, so that a key is tested with a single
+ * unsigned comparison instead of parsing every condition again. A batch
+ * of tuples is filtered in passes over a selection vector (the positions
+ * of the tuples that passed so far): the key interval first, then the
+ * excluded keys, and the conditions on the value last, only for the
+ * tuples whose key passed.
+ *
+ * A long value is compared by the prefix kept in its record. The rest of
+ * the value is read from the overflow pages only when the prefix cannot
+ * decide the comparison, which takes a condition value that starts with
+ * the whole prefix.
+ */
+class ScanFilter {
+ public:
+  /**
+   * compile the conditions of a SELECT.
+   * @param cond[IN] the conditions, all of which must be met
+   * @param rf[IN] the table whose values are filtered, which reads the
+   *        overflowed values. NULL if the values are never overflowed
+   */
+  ScanFilter(const std::vector<SelCond>& cond, const RecordFile* rf = NULL);
+
+  /**
+   * intersect the conditions on the key into the interval [lo, hi].
+   * conditions on the value and <> conditions are not considered.
+   * @param cond[IN] the conditions of the SELECT
+   * @param lo[OUT] the smallest key that satisfies the conditions
+   * @param hi[OUT] the largest key that satisfies the conditions
+   * @return false if no key satisfies the conditions
+   */
+  static bool keyRange(const std::vector<SelCond>& cond, int& lo, int& hi);
+
+  /**
+   * @return true if no tuple can satisfy the conditions on the key
+   */
+  bool isEmpty() const { return lo > hi; }
+
+  int getLowKey() const  { return lo; }
+  int getHighKey() const { return hi; }
+
+  /**
+   * @return true if a condition is on the value
+   */
+  bool hasValueConds() const { return !valueConds.empty(); }
+
+  /**
+   * @param key[IN] the key of a tuple
+   * @return true if the key satisfies the conditions on the key
+   */
+  bool matchKey(int key) const;
+
+  /**
+   * @param value[IN] the value of a tuple
+   * @return true if the value satisfies the conditions on the value
+   */
+  bool matchValue(const char* value) const;
+
+  /**
+   * select the tuples of a batch that satisfy the conditions.
+   * @param keys[IN] the keys of the tuples
+   * @param values[IN] the values of the tuples. may be NULL if there is
+   *        no condition on the value
+   * @param count[IN] the number of tuples in the batch
+   * @param sel[OUT] the positions of the selected tuples in increasing
+   *        order. it must hold count entries
+   * @return the number of selected tuples
+   */
+  int filter(const int* keys, const char* const* values, int count, int* sel) const;
+
+ private:
+  struct ValueCond {
+    SelCond::Comparator comp;
+    std::string value;
+    bool prefixed;  // whether the value is as long as the prefix of a long value
+  };
+
+  const RecordFile* rf;               // the table, to read overflowed values
+
+  int lo, hi;                         // the interval of the matching keys
+  std::vector<int> excluded;          // the keys excluded by <>
+  std::vector<ValueCond> valueConds;  // the conditions on the value
+};
+
+#endif /* SCANFILTER_H */
@@ -8,14 +8,28 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 
 // Custom Includes
 #include "RecordFile.h"
 #include "BTreeIndex.h"
+#include "TableStats.h"
+#include "ScanFilter.h"
+#include "LoadFile.h"
 
 using namespace std;
 
@@ -23,6 +37,322 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// # of pages read ahead of a table scan
+static const int READ_AHEAD_PAGES = 8;
+
+// # of index entries whose tuples an index scan fetches together
+static const int FETCH_BATCH = 1024;
+
+// # of table pages that a scan thread claims at a time
+static const int SCAN_MORSEL_PAGES = 16;
+
+// # of claimed morsels whose output may wait to be printed
+static const int SCAN_OUTPUT_WINDOW = 256;
+
+// # of bytes of the load file that LOAD parses at a time
+static const int LOAD_CHUNK_BYTES = 1 << 20;
+
+// # of chunks of the load file that are read ahead of the appended tuples
+// per LOAD thread
+static const int LOAD_CHUNKS_PER_THREAD = 4;
+
+// how full LOAD packs the nodes of a new index, in percent
+int SqlEngine::indexFillPercent = BTreeIndex::DEFAULT_FILL_PERCENT;
+
+// the # of threads of a table scan or LOAD
+int SqlEngine::threads = 1;
+
+// the access path of the last SELECT
+string SqlEngine::lastPlan = "none";
+
+// the access paths of SELECT
+static const int TABLE_SCAN  = 0;  // read every page of the table
+static const int INDEX_SCAN  = 1;  // read the leaves in the key range and their tuples
+static const int INDEX_ONLY  = 2;  // read the leaves in the key range only
+static const int INDEX_COUNT = 3;  // read the paths to the ends of the key range
+static const char* PLAN_NAMES[] = { "table scan", "index scan", "index-only scan", "index count" };
+
+/*
+ * Count the index entries that satisfy the conditions on the key.
+ * The entries in the key range are counted from the entry counts of the
+ * nonleaf nodes, and the entries of the keys excluded by <> conditions
+ * are subtracted.
+ * @param index[IN] the index of the table
+ * @param cond[IN] the conditions of the SELECT, all on the key
+ * @param count[OUT] the number of matching entries
+ * @return error code. 0 if no error
+ */
+static RC countKeys(BTreeIndex& index, const vector<SelCond>& cond, int& count)
+{
+  RC  rc;
+  int lo, hi, excluded;
+
+  count = 0;
+  if (!ScanFilter::keyRange(cond, lo, hi)) return 0;
+  if ((rc = index.countRange(lo, hi, count)) < 0) return rc;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].comp != SelCond::NE) continue;
+    int v = atoi(cond[i].value);
+    if (v < lo || v > hi) continue;
+
+    // the same key may be excluded more than once
+    bool seen = false;
+    for (unsigned j = 0; j < i; j++)
+      if (cond[j].comp == SelCond::NE && atoi(cond[j].value) == v) seen = true;
+    if (seen) continue;
+
+    if ((rc = index.countRange(v, v, excluded)) < 0) return rc;
+    count -= excluded;
+  }
+  return 0;
+}
+
+/*
+ * Make a value read in place whole before it is printed. the value of a
+ * tuple points into its page, where a long value has only its prefix.
+ * @param rf[IN] the table file
+ * @param value[IN/OUT] the value in the page. it is pointed to whole if the
+ *        rest of it was read from the overflow pages
+ * @param whole[OUT] the buffer for the whole value
+ * @return error code. 0 if no error
+ */
+static RC wholeValue(const RecordFile& rf, const char*& value, string& whole)
+{
+  RC rc;
+
+  if (!rf.isOverflowed(value)) return 0;
+  if ((rc = rf.readValue(value, whole)) < 0) return rc;
+  value = whole.c_str();
+  return 0;
+}
+
+/*
+ * Order index entries by the location of their tuples.
+ */
+static bool ridOrder(const IndexEntry& e1, const IndexEntry& e2)
+{
+  return e1.rid < e2.rid;
+}
+
+/*
+ * Choose the access path of a SELECT that reads the fewest pages.
+ * The page reads of every path are estimated from the statistics of the
+ * table. A table loaded without statistics uses its index if the query
+ * needs only the keys or bounds the key.
+ * @param attr[IN] attribute in the SELECT clause
+ * @param cond[IN] the conditions of the SELECT
+ * @param index[IN] the index of the table, or NULL if there is none
+ * @param stats[IN] the statistics of the table, or NULL if there are none
+ * @param cost[OUT] the estimated page reads of the chosen path. -1 if unknown
+ * @return the chosen access path
+ */
+static int choosePlan(int attr, const vector<SelCond>& cond, BTreeIndex* index,
+                      const TableStats* stats, double& cost)
+{
+  bool   keysOnly = (attr == 1 || attr == 4);  // the value is not needed
+  int    lo, hi;
+  int    excluded = 0;                         // # of <> conditions on the key
+  double costs[4];
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 2) keysOnly = false;
+    else if (cond[i].comp == SelCond::NE) excluded++;
+  }
+  bool empty = !ScanFilter::keyRange(cond, lo, hi);
+
+  cost = -1;
+  if (index == NULL) return TABLE_SCAN;
+  if (stats == NULL) {
+    if (keysOnly) return (attr == 4) ? INDEX_COUNT : INDEX_ONLY;
+    return (empty || lo > INT_MIN || hi < INT_MAX) ? INDEX_SCAN : TABLE_SCAN;
+  }
+
+  // the tuples in the key range, and the leaves that hold their entries
+  double tuples = empty ? 0 : stats->estimateTuples(lo, hi);
+  double perLeaf = max(1.0, (double) stats->getTupleCount() / max(index->getPageCount() - 1, 1));
+  double path = max(index->getTreeHeight(), 1);
+  double leaves = max(1.0, ceil(tuples / perLeaf));
+
+  // a batch of tuples fetched in rid order reads each of its table pages
+  // once. with the tuples spread over the table, a batch of b tuples
+  // touches about pages * (1 - e^(-b/pages)) distinct pages.
+  double pages = max(stats->getPageCount(), 1);
+  double batches = ceil(tuples / FETCH_BATCH);
+  double fetched = batches * pages * (1 - exp(-min(tuples, (double) FETCH_BATCH) / pages));
+
+  costs[TABLE_SCAN] = stats->getPageCount();
+  costs[INDEX_SCAN] = path - 1 + leaves + fetched;
+  costs[INDEX_ONLY] = path - 1 + leaves;
+  costs[INDEX_COUNT] = 2 * path * (1 + excluded);  // two paths per range counted
+
+  // the index paths come first, so that they win a tie
+  const int candidates[] = { INDEX_COUNT, INDEX_ONLY, INDEX_SCAN, TABLE_SCAN };
+  int plan = TABLE_SCAN;
+  cost = costs[TABLE_SCAN];
+  for (int i = 3; i >= 0; i--) {
+    int c = candidates[i];
+    if (!keysOnly && (c == INDEX_ONLY || c == INDEX_COUNT)) continue;
+    if (attr != 4 && c == INDEX_COUNT) continue;
+    if (costs[c] <= cost) {
+      plan = c;
+      cost = costs[c];
+    }
+  }
+  return plan;
+}
+
+/*
+ * The state shared by the threads of a parallel table scan.
+ * The table is split into morsels of SCAN_MORSEL_PAGES pages, which the
+ * threads claim one at a time from next. A thread that is slowed down by
+ * expensive pages simply claims fewer morsels, so the work stays balanced.
+ * The output of a morsel is kept in output until all the morsels before
+ * it are printed.
+ */
+struct ParallelScan {
+  const RecordFile* rf;
+  const ScanFilter* filter;
+  int               attr;
+  int               morsels;  // # of morsels in the table
+
+  std::atomic<int>  next;     // the next morsel to claim
+  std::atomic<int>  count;    // # of matching tuples
+
+  std::mutex        lock;     // protects the members below
+  std::condition_variable changed;
+  std::vector<std::string> output;  // the printed tuples of every morsel
+  std::vector<bool> done;     // whether every morsel is filtered
+  int               printed;  // # of morsels printed so far
+  RC                rc;       // the first error of a thread
+};
+
+/*
+ * The body of a scan thread: claim morsels and filter their pages,
+ * until every morsel is claimed or another thread fails.
+ */
+static void scanMorsels(ParallelScan* scan)
+{
+  RecordCursor cursor;
+  RecordId     rid;
+  PageId       endPid = scan->rf->endRid().pid + (scan->rf->endRid().sid > 0);
+  int          perPage = scan->rf->getRecordsPerPage();
+  vector<int>  keys(perPage), sel(perPage);
+  vector<const char*> values(perPage);
+  string       whole;  // an overflowed value, read whole
+  char         line[32];
+  RC           rc = 0;
+
+  cursor.open(*scan->rf, READ_AHEAD_PAGES);
+  for (int m; (m = scan->next++) < scan->morsels; ) {
+    string out;
+    int    count = 0;
+
+    // do not run too far ahead of the printed output
+    if (scan->attr != 4) {
+      std::unique_lock<std::mutex> guard(scan->lock);
+      scan->changed.wait(guard, [&] { return m < scan->printed + SCAN_OUTPUT_WINDOW || scan->rc < 0; });
+      if (scan->rc < 0) break;
+    }
+
+    cursor.seek(m * SCAN_MORSEL_PAGES);
+    PageId last = min((m + 1) * SCAN_MORSEL_PAGES, endPid);
+    for (PageId pid = m * SCAN_MORSEL_PAGES; pid < last; pid++) {
+      int n, selected;
+      if ((rc = cursor.nextPage(rid, &keys[0], &values[0], n)) < 0) break;
+      selected = scan->filter->filter(&keys[0], &values[0], n, &sel[0]);
+      count += selected;
+
+      // format the selected tuples the way a serial scan prints them
+      for (int i = 0; i < selected && scan->attr != 4; i++) {
+        const char* value = values[sel[i]];
+        if (scan->attr != 1 && (rc = wholeValue(*scan->rf, value, whole)) < 0) break;
+        switch (scan->attr) {
+        case 1:  // SELECT key
+          out.append(line, snprintf(line, sizeof(line), "%d\n", keys[sel[i]]));
+          break;
+        case 2:  // SELECT value
+          out.append(value).append("\n");
+          break;
+        case 3:  // SELECT *
+          out.append(line, snprintf(line, sizeof(line), "%d '", keys[sel[i]]));
+          out.append(value).append("'\n");
+          break;
+        }
+      }
+      if (rc < 0) break;
+    }
+    scan->count += count;
+
+    std::lock_guard<std::mutex> guard(scan->lock);
+    if (rc < 0) {
+      if (scan->rc == 0) scan->rc = rc;
+      scan->changed.notify_all();
+      break;
+    }
+    scan->output[m].swap(out);
+    scan->done[m] = true;
+    scan->changed.notify_all();
+  }
+  cursor.close();
+}
+
+/*
+ * Scan a table with several threads and print the matching tuples in the
+ * order of a serial scan. The threads filter the morsels of the table,
+ * while this thread prints the output of every morsel once the morsels
+ * before it are printed. COUNT(*) only adds up the counts of the threads.
+ * @param rf[IN] the table file
+ * @param filter[IN] the conditions of the SELECT
+ * @param attr[IN] attribute in the SELECT clause
+ * @param threads[IN] the number of scan threads
+ * @param count[OUT] the number of matching tuples
+ * @return error code. 0 if no error
+ */
+static RC parallelScan(const RecordFile& rf, const ScanFilter& filter, int attr,
+                       int threads, int& count)
+{
+  ParallelScan scan;
+  vector<std::thread> workers;
+  PageId endPid = rf.endRid().pid + (rf.endRid().sid > 0);
+
+  scan.rf = &rf;
+  scan.filter = &filter;
+  scan.attr = attr;
+  scan.morsels = (endPid + SCAN_MORSEL_PAGES - 1) / SCAN_MORSEL_PAGES;
+  scan.next = 0;
+  scan.count = 0;
+  scan.output.resize(scan.morsels);
+  scan.done.resize(scan.morsels, false);
+  scan.printed = 0;
+  scan.rc = 0;
+
+  for (int i = 0; i < min(threads, scan.morsels); i++)
+    workers.push_back(std::thread(scanMorsels, &scan));
+
+  // print the morsels in order as they are done
+  if (attr != 4) {
+    for (int m = 0; m < scan.morsels; m++) {
+      string out;
+      {
+        std::unique_lock<std::mutex> guard(scan.lock);
+        scan.changed.wait(guard, [&] { return scan.done[m] || scan.rc < 0; });
+        if (scan.rc < 0) break;
+        out.swap(scan.output[m]);
+      }
+      fwrite(out.data(), 1, out.size(), stdout);
+
+      std::lock_guard<std::mutex> guard(scan.lock);
+      scan.printed = m + 1;
+      scan.changed.notify_all();
+    }
+  }
+
+  for (unsigned i = 0; i < workers.size(); i++)
+    workers[i].join();
+  count = scan.count;
+  return scan.rc;
+}
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -41,219 +371,191 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   RecordFile rf;   // RecordFile containing the table
   RecordId   rid;  // record cursor for table scanning
 
-  RC     rc;
+  RC     rc = 0;
   int    key;     
-  string value;
   int    count = 0;
-  int    diff;
-  int lookUpCondition = -1;
   BTreeIndex indexFile;
+  TableStats stats;
+  bool   hasIndex, hasStats;
+  bool   indexOnly = false;  // true if the table file is not read
+  int    plan;
+  double cost;
+  char   planText[64];
+  string whole;             // an overflowed value, read whole
+  ScanFilter filter(cond, &rf);  // the conditions compiled for this query
+
+  // choose between the table and the index by the estimated page reads
+  hasIndex = (indexFile.open(table + ".idx", 'r') == 0);
+  hasStats = (stats.read(table + ".stat") == 0);
+  plan = choosePlan(attr, cond, hasIndex ? &indexFile : NULL, hasStats ? &stats : NULL, cost);
+  if (cost < 0)
+    lastPlan = PLAN_NAMES[plan];
+  else {
+    snprintf(planText, sizeof(planText), "%s (estimated %.0f pages)", PLAN_NAMES[plan], cost);
+    lastPlan = planText;
+  }
 
-  if (indexFile.open(table + ".idx", 'r') == 0 ) { //if indexfile opens in read mode
+  if (plan != TABLE_SCAN) {
     IndexCursor cur;
-
-    cout << "SqlEngine :: select -- indexFile opened" << endl;
-
-    // iterates through every condition in the SELECT statement
-    for(int i = 0; i < cond.size(); i++){
-      // Gets the keys 
-      int lookUpConditionKey;
-      int iKey;
-
-      cout << "SqlEngine :: select -- in forloop to iterate through conditions" << endl;
-
-      if(lookUpCondition > -1) {
-        lookUpConditionKey = atoi(cond[lookUpCondition].value);
-        cout << "SqlEngine :: select -- lookUpCondition: " << lookUpCondition << endl;
-        cout << "SqlEngine :: select -- lookUpConditionKey: " << lookUpConditionKey << endl;
+    IndexEntry  entry;
+    vector<IndexEntry> batch;  // the index entries whose tuples are fetched next
+    PinnedPage  page;          // the table page of the last fetched tuple
+    const char* val = "";      // the value of the fetched tuple
+
+    // contradictory key conditions match nothing, so no page is read
+    if (filter.isEmpty())
+      goto is_count;
+
+    // COUNT(*) and SELECT key need only the keys. unless a condition is
+    // on the value, they are answered from the index leaves alone.
+    indexOnly = (plan == INDEX_ONLY || plan == INDEX_COUNT);
+
+    // open the table file. records are fetched in index order
+    if (!indexOnly) {
+      if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+        fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+        indexFile.close();
+        return rc;
       }
-      iKey = atoi(cond[i].value);
-
-      if(cond[i].attr == 2) // If it is a value attribute continue
-          continue;
+      rf.setAccessPattern(PageFile::ACCESS_RANDOM);
+    }
 
-      // Condition Comparison's
-      switch(cond[i].comp)
-      {
-        case SelCond::NE:
-          continue;
-        case SelCond::EQ:
-          lookUpCondition = i;
-          break;
-        case SelCond::GT:
-        case SelCond::GE:
-          if(lookUpCondition == -1  || atoi(cond[lookUpCondition].value) < iKey) // if a later condition has a GT or GE key greater than lookUpCondition's
-            lookUpCondition = i;
-            break;
-        default:
-            break;
+    // COUNT(*) reads only the paths to the ends of the key range
+    if (plan == INDEX_COUNT) {
+      if ((rc = countKeys(indexFile, cond, count)) < 0) {
+        fprintf(stderr, "Error: while counting the index entries of table %s\n", table.c_str());
+        goto exit_select;
       }
-
-      cout << "SqlEngine :: select -- lookUpCondition: " << lookUpCondition << endl;
-      cout << "SqlEngine :: select -- lookUpConditionKey: " << atoi(cond[lookUpCondition].value) << endl;
-      cout << "SqlEngine :: select -- iKey: " << iKey << endl;
+      goto is_count;
     }
 
-    // Get Index Cursor in Tree to Key
-    if(lookUpCondition > -1) {
-      indexFile.locate(atoi(cond[lookUpCondition].value), cur);
-      cout << "SqlEngine :: select -- cur.pid: " << cur.pid << endl;
-      cout << "SqlEngine :: select -- cur.eid: " << cur.eid << endl;
+    // position the cursor at the first key >= lo, and walk the leaves
+    // until the first key > hi. the entries are fetched in batches: the
+    // entries of a batch are sorted by rid, so that every table page of
+    // the batch is pinned once instead of once per tuple.
+    // an empty tree has no key >= lo, and the scan below finds no entry
+    rc = indexFile.locate(filter.getLowKey(), cur);
+    if (rc < 0 && rc != RC_NO_SUCH_RECORD && rc != RC_END_OF_TREE) {
+      fprintf(stderr, "Error: while searching the index of table %s\n", table.c_str());
+      goto exit_select;
     }
-    else
-      indexFile.locate(0, cur);
-    
-    rid.pid = rid.sid = 0;
-    while(indexFile.readForward(cur, key, rid) == 0) // returns 0 if no error
-    {
-      if ((rc = rf.read(rid, key, value)) > 0) { // reads in a tuple
-        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-        rf.close();
-        return rc;
+    do {
+      batch.clear();
+      while ((int) batch.size() < FETCH_BATCH &&
+             (rc = indexFile.readForward(cur, entry.key, entry.rid)) == 0) {
+        if (entry.key > filter.getHighKey()) {
+          rc = RC_END_OF_TREE;
+          break;
+        }
+
+        // skip the keys excluded by <> before reading their tuples
+        if (filter.matchKey(entry.key))
+          batch.push_back(entry);
+      }
+      if (rc < 0 && rc != RC_END_OF_TREE) {
+        fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+        goto exit_select;
       }
 
-      // iterates through every condition in the SELECT statement
-      // check the conditions on the tuple
-      for (unsigned i = 0; i < cond.size(); i++) {
-        // compute the difference between the tuple value and the condition value
-        switch (cond[i].attr) {
-        case 1:
-          diff = key - atoi(cond[i].value);
-          break;
-        case 2:
-          diff = strcmp(value.c_str(), cond[i].value);
-          break;
-        default:
+      // sort the batch by rid, and start reading every run of
+      // consecutive table pages in the background
+      if (!indexOnly) {
+        sort(batch.begin(), batch.end(), ridOrder);
+        for (unsigned i = 0, j; i < batch.size(); i = j) {
+          for (j = i + 1; j < batch.size() && batch[j].rid.pid <= batch[j-1].rid.pid + 1; j++);
+          rf.prefetch(batch[i].rid.pid, batch[j-1].rid.pid - batch[i].rid.pid + 1);
+        }
+      }
+
+      for (unsigned b = 0; b < batch.size(); b++) {
+        key = batch[b].key;
+        if (!indexOnly && (rc = rf.read(batch[b].rid, key, val, page)) < 0) { // reads in a tuple
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
+        }
+
+        // check the conditions on the value, which the index does not cover
+        if (!filter.matchValue(val))
           continue;
+
+        // the condition is met for the tuple. 
+        // increase matching tuple counter
+        count++;
+        if (attr != 1 && attr != 4 && (rc = wholeValue(rf, val, whole)) < 0) {
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
         }
 
-        // skip the tuple if any condition is not met
-        switch (cond[i].comp) {
-        case SelCond::EQ:
-          if (diff != 0) 
-            if(cond[i].attr == 1)
-              goto is_count;
-            else 
-              continue;
-          break;
-        case SelCond::NE:
-          if (diff == 0) 
-            continue;
+        // print the tuple 
+        switch (attr) {
+        case 1:  // SELECT key
+          fprintf(stdout, "%d\n", key);
           break;
-        case SelCond::GT:
-          if (diff <= 0)
-            continue;
+        case 2:  // SELECT value
+          fprintf(stdout, "%s\n", val);
           break;
-        case SelCond::LT:
-          if (diff >= 0) 
-            if(cond[i].attr == 1)
-              goto is_count;
-            else
-              continue;
-          break;
-        case SelCond::GE:
-          if (diff < 0) 
-            continue;
-          break;
-        case SelCond::LE:
-          if (diff > 0)
-            if(cond[i].attr == 1)
-              goto is_count;
-            else 
-              continue;
+        case 3:  // SELECT *
+          fprintf(stdout, "%d '%s'\n", key, val);
           break;
         }
       }
-
-      // the condition is met for the tuple. 
-      // increase matching tuple counter
-      count++;
-
-      // print the tuple 
-      switch (attr) {
-      case 1:  // SELECT key
-        fprintf(stdout, "%d\n", key);
-        break;
-      case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
-        break;
-      case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
-        break;
-      }
-    }
+    } while (rc == 0);
   }
-  else { //no index file present
-      // open the table file
+  else { // scan the table
+    RecordCursor scan;   // cursor over the records of the table
+    int perPage;         // # of record slots in a page
+    int n, selected;
+
+    // open the table file
     if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
       fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-      return rc;
+      goto exit_select;
     }
-    // scan the table file from the beginning
-    rid.pid = rid.sid = 0;
-    count = 0;
-    while (rid < rf.endRid()) {
-      // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
+    rf.setAccessPattern(PageFile::ACCESS_SEQUENTIAL);
+
+    // filter the pages with several threads if asked to
+    if (threads > 1) {
+      if ((rc = parallelScan(rf, filter, attr, threads, count)) < 0) {
         fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
         goto exit_select;
       }
+      goto is_count;
+    }
 
-      // check the conditions on the tuple
-      for (unsigned i = 0; i < cond.size(); i++) {
-        // compute the difference between the tuple value and the condition value
-        switch (cond[i].attr) {
-        case 1:
-  	diff = key - atoi(cond[i].value);
-  	break;
-        case 2:
-  	diff = strcmp(value.c_str(), cond[i].value);
-  	break;
-        }
+    // the columns of a page: the keys, the values and the selection vector
+    perPage = rf.getRecordsPerPage();
+    vector<int> keys(perPage), sel(perPage);
+    vector<const char*> values(perPage);
 
-        // skip the tuple if any condition is not met
-        switch (cond[i].comp) {
-        case SelCond::EQ:
-  	if (diff != 0) goto next_tuple;
-  	break;
-        case SelCond::NE:
-  	if (diff == 0) goto next_tuple;
-  	break;
-        case SelCond::GT:
-  	if (diff <= 0) goto next_tuple;
-  	break;
-        case SelCond::LT:
-  	if (diff >= 0) goto next_tuple;
-  	break;
-        case SelCond::GE:
-  	if (diff < 0) goto next_tuple;
-  	break;
-        case SelCond::LE:
-  	if (diff > 0) goto next_tuple;
-  	break;
-        }
-      }
-
-      // the condition is met for the tuple. 
-      // increase matching tuple counter
-      count++;
+    // scan the table file from the beginning, a page at a time.
+    // the next pages are read while the current one is being filtered.
+    scan.open(rf, READ_AHEAD_PAGES);
+    count = 0;
+    while ((rc = scan.nextPage(rid, &keys[0], &values[0], n)) == 0) {
+      // select the tuples of the page that meet the conditions
+      selected = filter.filter(&keys[0], &values[0], n, &sel[0]);
+      count += selected;
 
-      // print the tuple 
+      // print the selected tuples
       switch (attr) {
       case 1:  // SELECT key
-        fprintf(stdout, "%d\n", key);
+        for (int i = 0; i < selected; i++)
+          fprintf(stdout, "%d\n", keys[sel[i]]);
         break;
       case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
+        for (int i = 0; i < selected && (rc = wholeValue(rf, values[sel[i]], whole)) == 0; i++)
+          fprintf(stdout, "%s\n", values[sel[i]]);
         break;
       case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
+        for (int i = 0; i < selected && (rc = wholeValue(rf, values[sel[i]], whole)) == 0; i++)
+          fprintf(stdout, "%d '%s'\n", keys[sel[i]], values[sel[i]]);
         break;
       }
-
-      // move to the next tuple
-      next_tuple:
-      ++rid;
+      if (rc < 0) break;
+    }
+    if (rc != RC_NO_SUCH_RECORD) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
     }
     }
     is_count:
@@ -265,74 +567,225 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   
   // close the table file and return
   exit_select:
-  rf.close();
+  if (!indexOnly) rf.close();
+  if (hasIndex) indexFile.close();
   return rc;
 
 }
 
+/*
+ * A chunk of the load file that ends at a line boundary, and the tuples
+ * parsed from it.
+ */
+struct LoadChunk {
+  size_t    begin, end;  // the offsets of the chunk in the load file
+  LoadBatch batch;       // the tuples of the chunk
+  bool      parsed;      // whether the chunk is parsed
+};
+
+/*
+ * The state shared by the threads that parse a load file.
+ * The chunks are parsed in any order, but LOAD appends their tuples in
+ * the order of the file, so the RecordIds do not depend on the threads.
+ */
+struct ParallelLoad {
+  const LoadFile*         file;     // the load file
+
+  std::mutex              lock;     // protects the members below
+  std::condition_variable changed;
+  std::deque<LoadChunk*>  todo;     // the chunks that are not parsed yet
+  bool                    finished; // whether the whole file was read
+};
+
+/*
+ * The body of a parser thread: parse chunks until the whole file is read.
+ */
+static void parseChunks(ParallelLoad* load)
+{
+  while (true) {
+    LoadChunk* chunk;
+    {
+      std::unique_lock<std::mutex> guard(load->lock);
+      load->changed.wait(guard, [&] { return !load->todo.empty() || load->finished; });
+      if (load->todo.empty()) return;
+      chunk = load->todo.front();
+      load->todo.pop_front();
+    }
+
+    load->file->parse(chunk->begin, chunk->end, chunk->batch);
+
+    std::lock_guard<std::mutex> guard(load->lock);
+    chunk->parsed = true;
+    load->changed.notify_all();
+  }
+}
+
 RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 {
-  ifstream myLoadFile;
-  string tuple, myValue, tableName;
+  RC rc = 0;
+  LoadFile myLoadFile;
+  RecordFile myTable;
+  string myValue, tableName, indexName;
   int myKey;
+  bool bulk = false;
+  long long lines = 0, bytes = 0;
+  int writes = PageFile::getPageWriteCount(), flushes = PageFile::getFlushCount(), dirty;
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+  // Checks if file was succesfully opened (mapped into memory)
+  if (myLoadFile.open(loadfile) < 0)
+  {
+    cout << "Cannot Open File \n" << endl;
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  // Opens/Creates the table
+  tableName = table + ".tbl";
+  if (myTable.open(tableName, 'w') < 0) {
+    myLoadFile.close();
+    return RC_FILE_OPEN_FAILED;
+  }
 
   // Opens index file if index = true;
   BTreeIndex indexFile;
   if (index)
   {
-    string indexName = table + ".idx";
+    indexName = table + ".idx";
 
-    if (indexFile.open(indexName, 'w'))
+    if (indexFile.open(indexName, 'w') < 0)
     {
+      myTable.close();
+      myLoadFile.close();
       return RC_FILE_OPEN_FAILED;
     }
+
+    // a new index is built bottom-up after all tuples are loaded.
+    // tuples added to an existing index are inserted one by one.
+    bulk = (indexFile.beginBulkLoad(indexFillPercent) == 0);
   }
-  
-  myLoadFile.open(loadfile.c_str());
 
-  // Checks if file was succesfully opened
-  if(myLoadFile.is_open())
-  {
-    // Opens/Creates the table
-    RecordFile myTable; 
-    tableName = table + ".tbl";
-    if (myTable.open(tableName, 'w')) {
-      return RC_FILE_OPEN_FAILED;
+  // the statistics of a new table start empty. those of a table that
+  // was loaded before are updated, unless they were never collected
+  TableStats stats;
+  string statName = table + ".stat";
+  RecordId end = myTable.endRid();
+  bool collectStats = (end.pid == 0 && end.sid == 0) || stats.read(statName) == 0;
+
+  // the load file is split into chunks, which the parser threads parse
+  // while the tuples of the earlier chunks are appended. with a single
+  // thread, every chunk is parsed right before it is appended.
+  ParallelLoad parallel;
+  vector<std::thread> parsers;
+  deque<LoadChunk*> chunks;  // the chunks in flight, in file order
+  size_t offset = 0;         // where the next chunk starts
+
+  parallel.file = &myLoadFile;
+  parallel.finished = false;
+  for (int i = 1; i < threads; i++)
+    parsers.push_back(std::thread(parseChunks, &parallel));
+
+  while (rc == 0) {
+    // keep enough chunks in flight for the parser threads
+    while (offset < myLoadFile.size() && (int) chunks.size() < threads * LOAD_CHUNKS_PER_THREAD) {
+      LoadChunk* chunk = new LoadChunk;
+      chunk->begin = offset;
+      chunk->end = offset = myLoadFile.chunkEnd(offset, LOAD_CHUNK_BYTES);
+      chunk->batch.clear();
+      chunk->parsed = false;
+      chunks.push_back(chunk);
+
+      if (parsers.empty()) {
+        myLoadFile.parse(chunk->begin, chunk->end, chunk->batch);
+        chunk->parsed = true;
+      } else {
+        std::lock_guard<std::mutex> guard(parallel.lock);
+        parallel.todo.push_back(chunk);
+        parallel.changed.notify_one();
+      }
+    }
+    if (chunks.empty()) break;
+
+    // wait for the first chunk to be parsed
+    LoadChunk* chunk = chunks.front();
+    chunks.pop_front();
+    if (!parsers.empty()) {
+      std::unique_lock<std::mutex> guard(parallel.lock);
+      parallel.changed.wait(guard, [&] { return chunk->parsed; });
     }
 
-    // While the loadfile is not at EOF, it reads each line and parses it
     // Inserting each parsed tuple into the table
-    while(!myLoadFile.eof()){
-      getline(myLoadFile, tuple);
-      
-      // Appends only if it parses a tuple correctly
-      if(!parseLoadLine(tuple, myKey, myValue))
+    const LoadBatch& batch = chunk->batch;
+    lines += batch.lines;
+    for (unsigned i = 0; i < batch.keys.size(); i++) {
+      RecordId lastRid;
+
+      myKey = batch.keys[i];
+      myValue.assign(batch.values[i], batch.lengths[i]);
+      if ((rc = myTable.bufferedAppend((int)myKey, myValue, lastRid)) < 0)
       {
-        RecordId lastRid;
-
-        myTable.append((int)myKey, myValue, lastRid);
-
-        if (index)
-        { 
-          if (indexFile.insert(myKey, lastRid))
-          {
-            cout << "Error: NOT INSERTED INTO INDEX" <<endl;
-          }
+        cout << "Error: cannot append the tuple with key " << myKey << " to table " << table << endl;
+        break;
+      }
+      if (collectStats) stats.add(myKey);
+
+      if (index)
+      { 
+        RC irc = bulk ? indexFile.bulkInsert(myKey, lastRid) : indexFile.insert(myKey, lastRid);
+        if (irc < 0)
+        {
+          cout << "Error: NOT INSERTED INTO INDEX" <<endl;
         }
       }
     }
-    myTable.close();
+    delete chunk;
   }
-  else
+
+  // the parser threads finish the chunks they were given before they
+  // exit, so the chunks left after an error can be freed once they join
   {
-    cout << "Cannot Open File \n" << endl;
-    return RC_FILE_OPEN_FAILED;
+    std::lock_guard<std::mutex> guard(parallel.lock);
+    parallel.finished = true;
+    parallel.changed.notify_all();
   }
+  for (unsigned i = 0; i < parsers.size(); i++)
+    parsers[i].join();
+  for (unsigned i = 0; i < chunks.size(); i++)
+    delete chunks[i];
+
+  // the pages that write-back still holds in the buffer pool
+  dirty = PageFile::getDirtyPageCount();
+
+  if (collectStats) {
+    end = myTable.endRid();
+    stats.setPageCount(end.pid + (end.sid > 0 ? 1 : 0));
+    if (stats.write(statName) < 0)
+      cout << "Error: cannot write the statistics of table " << table << endl;
+  }
+  myTable.close();
+
+  bytes = myLoadFile.size();
   myLoadFile.close();
   if (index)
   {
+    // after an error, the bulk load is abandoned: close() drops the pairs.
+    // the index would then look like an empty tree to SELECT, so the file
+    // is removed and the table is read without an index. the same goes
+    // for an index that could not be built.
+    if (rc == 0 && bulk && (rc = indexFile.endBulkLoad()) < 0)
+    {
+      cout << "Error: cannot build the index" << endl;
+    }
     indexFile.close();
+    if (rc < 0 && bulk) remove(indexName.c_str());
   }
+  if (rc < 0) return rc;
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+  double seconds = max(elapsed.count(), 1e-6);
+  fprintf(stderr, "  -- %.3f seconds to load %lld lines (%.0f lines/sec, %.1f MB/sec). "
+          "Wrote %d pages (%d flushes, %d dirty pages before close)\n",
+          elapsed.count(), lines, lines / seconds, bytes / seconds / (1 << 20),
+          PageFile::getPageWriteCount() - writes, PageFile::getFlushCount() - flushes, dirty);
   return 0;
 }
 
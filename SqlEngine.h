@@ -67,6 +67,37 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * set how full LOAD packs the nodes of a new index.
+   * a lower fill factor leaves room for later inserts without splits.
+   * @param percent[IN] the fill factor in percent (1 to 100)
+   */
+  static void setIndexFillFactor(int percent) { indexFillPercent = percent; }
+
+  /**
+   * set the number of threads that scan a table or parse a load file.
+   * with more than one thread, the pages of a table are filtered in
+   * parallel, and the result is printed in the order of a serial scan.
+   * LOAD parses the chunks of the load file in parallel, and appends the
+   * tuples in the order of the file.
+   * @param threads[IN] the number of threads (1 for serial execution)
+   */
+  static void setThreads(int count) { threads = count; }
+
+  /**
+   * the access path that the last SELECT used: a table scan, an index
+   * scan, an index-only scan that did not read the table file, or an
+   * index count that read only the nonleaf entry counts. the estimated
+   * page reads of the path follow if the table has statistics.
+   * @return the name of the access path
+   */
+  static const char* getLastPlan() { return lastPlan.c_str(); }
+
+ private:
+  static int indexFillPercent;  // the fill factor of new indexes in percent
+  static int threads;           // the # of threads of a table scan or LOAD
+  static std::string lastPlan;  // the access path of the last SELECT
 };
 
 #endif /* SQLENGINE_H */
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstring>
 #include <sys/times.h>
+#include <unistd.h>
 #include <climits>
 #include <string>
 #include "Bruinbase.h"
@@ -17,14 +18,26 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   struct tms tmsbuf;
   clock_t btime, etime;
   int     bpagecnt, epagecnt;
+  int     bhitcnt, ehitcnt;
+  int     bmapcnt, emapcnt;
+  int     bprecnt, eprecnt;
+  int     bflushcnt, eflushcnt;
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
+  bhitcnt = PageFile::getCacheHitCount();
+  bmapcnt = PageFile::getMappedReadCount();
+  bprecnt = PageFile::getPrefetchCount();
+  bflushcnt = PageFile::getFlushCount();
   SqlEngine::select(attr, table, conds);
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
+  ehitcnt = PageFile::getCacheHitCount();
+  emapcnt = PageFile::getMappedReadCount();
+  eprecnt = PageFile::getPrefetchCount();
+  eflushcnt = PageFile::getFlushCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages (%d read ahead, %d buffer pool hits, %d mmap reads, %d flushes, %d dirty pages), plan: %s\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt, eprecnt - bprecnt, ehitcnt - bhitcnt, emapcnt - bmapcnt, eflushcnt - bflushcnt, PageFile::getDirtyPageCount(), SqlEngine::getLastPlan());
 }
 
 %}
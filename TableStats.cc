@@ -0,0 +1,147 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "TableStats.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+//
+// The statistics file holds one StatsFile record. It starts with a magic
+// string and a version, so that a file of another format is rejected.
+//
+static const char STATS_MAGIC[8] = "BRUINST";
+static const int  STATS_VERSION = 1;
+
+struct StatsFile {
+  char      magic[8];   // STATS_MAGIC
+  int       version;    // STATS_VERSION
+  int       tupleCount;
+  int       pageCount;
+  int       minKey;
+  int       maxKey;
+  long long base;
+  long long width;
+  int       buckets[TableStats::HISTOGRAM_BUCKETS];
+};
+
+TableStats::TableStats()
+{
+  tupleCount = 0;
+  pageCount = 0;
+  minKey = maxKey = 0;
+  base = 0;
+  width = 1;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+RC TableStats::read(const string& filename)
+{
+  StatsFile file;
+  FILE* fp;
+
+  if ((fp = fopen(filename.c_str(), "rb")) == NULL) return RC_FILE_OPEN_FAILED;
+  size_t n = fread(&file, sizeof(file), 1, fp);
+  fclose(fp);
+  if (n != 1) return RC_FILE_READ_FAILED;
+
+  if (memcmp(file.magic, STATS_MAGIC, sizeof(file.magic)) != 0 ||
+      file.version != STATS_VERSION || file.width < 1)
+    return RC_INVALID_FILE_FORMAT;
+
+  tupleCount = file.tupleCount;
+  pageCount = file.pageCount;
+  minKey = file.minKey;
+  maxKey = file.maxKey;
+  base = file.base;
+  width = file.width;
+  memcpy(buckets, file.buckets, sizeof(buckets));
+  return 0;
+}
+
+RC TableStats::write(const string& filename) const
+{
+  StatsFile file;
+  FILE* fp;
+
+  memset(&file, 0, sizeof(file));
+  memcpy(file.magic, STATS_MAGIC, sizeof(file.magic));
+  file.version = STATS_VERSION;
+  file.tupleCount = tupleCount;
+  file.pageCount = pageCount;
+  file.minKey = minKey;
+  file.maxKey = maxKey;
+  file.base = base;
+  file.width = width;
+  memcpy(file.buckets, buckets, sizeof(buckets));
+
+  if ((fp = fopen(filename.c_str(), "wb")) == NULL) return RC_FILE_OPEN_FAILED;
+  size_t n = fwrite(&file, sizeof(file), 1, fp);
+  if (fclose(fp) != 0 || n != 1) return RC_FILE_WRITE_FAILED;
+  return 0;
+}
+
+void TableStats::add(int key)
+{
+  if (tupleCount == 0) {
+    // the first key starts the range of the buckets
+    minKey = maxKey = key;
+    base = key;
+    width = 1;
+  } else {
+    minKey = min(minKey, key);
+    maxKey = max(maxKey, key);
+    widen(key);
+  }
+
+  buckets[(key - base) / width]++;
+  tupleCount++;
+}
+
+void TableStats::widen(int key)
+{
+  int merged[HISTOGRAM_BUCKETS];
+
+  while (key < base || key >= base + HISTOGRAM_BUCKETS * width) {
+    // merge the pairs of buckets into one half of the new buckets.
+    // the range grows downward if key is below it, and upward otherwise.
+    int half = (key < base) ? HISTOGRAM_BUCKETS / 2 : 0;
+
+    memset(merged, 0, sizeof(merged));
+    for (int i = 0; i < HISTOGRAM_BUCKETS / 2; i++)
+      merged[half + i] = buckets[2 * i] + buckets[2 * i + 1];
+    memcpy(buckets, merged, sizeof(buckets));
+
+    if (half > 0) base -= HISTOGRAM_BUCKETS * width;
+    width *= 2;
+  }
+}
+
+double TableStats::estimateTuples(int lo, int hi) const
+{
+  double tuples = 0;
+
+  if (tupleCount == 0) return 0;
+  lo = max(lo, minKey);
+  hi = min(hi, maxKey);
+  if (lo > hi) return 0;
+
+  // add up the part of every bucket that overlaps with [lo, hi].
+  // the first and last buckets hold keys only from minKey and up to maxKey
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    long long first = max(base + i * width, (long long) minKey);
+    long long last = min(base + (i + 1) * width - 1, (long long) maxKey);
+    long long from = max(first, (long long) lo);
+    long long to = min(last, (long long) hi);
+    if (from <= to) tuples += buckets[i] * (double) (to - from + 1) / (last - first + 1);
+  }
+  return tuples;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef TABLESTATS_H
+#define TABLESTATS_H
+
+#include <string>
+#include "Bruinbase.h"
+
+/**
+ * The statistics of a table that SELECT uses to choose an access path:
+ * the number of tuples and pages, the smallest and largest keys, and a
+ * histogram of the keys. LOAD updates the statistics as it appends the
+ * tuples, and stores them in a file next to the table.
+ *
+ * The histogram has HISTOGRAM_BUCKETS buckets of equal width. When a key
+ * falls outside of the range covered by the buckets, the bucket width is
+ * doubled (merging pairs of buckets) until the key is covered, so the
+ * histogram is built in one pass without knowing the key range ahead.
+ */
+class TableStats {
+ public:
+  static const int HISTOGRAM_BUCKETS = 64;
+
+  TableStats();
+
+  /**
+   * read the statistics from a file.
+   * @param filename[IN] the name of the statistics file
+   * @return error code. 0 if no error
+   */
+  RC read(const std::string& filename);
+
+  /**
+   * write the statistics to a file.
+   * @param filename[IN] the name of the statistics file
+   * @return error code. 0 if no error
+   */
+  RC write(const std::string& filename) const;
+
+  /**
+   * count a new tuple in the statistics.
+   * @param key[IN] the key of the tuple
+   */
+  void add(int key);
+
+  /**
+   * set the number of pages of the table.
+   * @param pages[IN] the number of pages that hold the tuples
+   */
+  void setPageCount(int pages) { pageCount = pages; }
+
+  int getTupleCount() const { return tupleCount; }
+  int getPageCount() const  { return pageCount; }
+  int getMinKey() const     { return minKey; }
+  int getMaxKey() const     { return maxKey; }
+
+  /**
+   * estimate the number of tuples whose key is in [lo, hi].
+   * the keys are assumed to be spread uniformly inside a bucket.
+   * @param lo[IN] the smallest key
+   * @param hi[IN] the largest key
+   * @return the estimated number of tuples
+   */
+  double estimateTuples(int lo, int hi) const;
+
+ private:
+  int       tupleCount;  // # of tuples in the table
+  int       pageCount;   // # of pages that hold the tuples
+  int       minKey;      // the smallest key. valid if tupleCount > 0
+  int       maxKey;      // the largest key. valid if tupleCount > 0
+
+  // bucket i counts the keys in [base + i * width, base + (i+1) * width)
+  long long base;
+  long long width;
+  int       buckets[HISTOGRAM_BUCKETS];
+
+  /*
+   * double the bucket width until key is covered by the buckets
+   */
+  void widen(int key);
+};
+
+#endif /* TABLESTATS_H */
@@ -0,0 +1,78 @@
+/**
+ * Microbenchmark of the key search inside a single B+tree node.
+ *
+ * For every page size and fill level, a leaf node and a nonleaf node are
+ * filled with sorted keys and searched with random keys through
+ * BTLeafNode::locate() and BTNonLeafNode::locateChildPtr().
+ * The cost of one search is reported in nanoseconds.
+ *
+ * usage: bench_btnode [# of lookups per measurement]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "BTreeNode.h"
+
+using namespace std;
+
+static double nsPerLookup(chrono::steady_clock::time_point begin, int lookups)
+{
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - begin;
+  return elapsed.count() / lookups;
+}
+
+int main(int argc, char** argv)
+{
+  int lookups = (argc > 1) ? atoi(argv[1]) : 2000000;
+  const int pageSizes[] = { 1024, 4096, 16384, 65536 };
+  const int fills[] = { 10, 25, 50, 75, 100 };
+  long long checksum = 0;
+
+  // the search keys are random, so that the branch predictor cannot learn them
+  vector<int> searchKeys(lookups);
+
+  printf("%9s %6s %8s %12s %12s\n", "page size", "fill", "keys", "leaf (ns)", "nonleaf (ns)");
+  for (size_t p = 0; p < sizeof(pageSizes) / sizeof(int); p++) {
+    for (size_t f = 0; f < sizeof(fills) / sizeof(int); f++) {
+      BTLeafNode* leaf = new BTLeafNode(pageSizes[p]);
+      BTNonLeafNode* nonleaf = new BTNonLeafNode(pageSizes[p]);
+      int keys = max(1, leaf->getMaxKeyCount() * fills[f] / 100);
+      int nonleafKeys = max(1, nonleaf->getMaxKeyCount() * fills[f] / 100);
+      RecordId rid = { 0, 0 };
+
+      // the keys are the even numbers, so that half of the searches miss
+      for (int i = 0; i < keys; i++) leaf->insert(2 * i, rid);
+      nonleaf->initializeRoot(0, 0, 1);
+      for (int i = 1; i < nonleafKeys; i++) nonleaf->insert(2 * i, i + 1);
+
+      srand(1);
+      for (int i = 0; i < lookups; i++) searchKeys[i] = rand() % (2 * keys + 2) - 1;
+
+      chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+      for (int i = 0; i < lookups; i++) {
+        int eid;
+        leaf->locate(searchKeys[i], eid);
+        checksum += eid;
+      }
+      double leafNs = nsPerLookup(begin, lookups);
+
+      begin = chrono::steady_clock::now();
+      for (int i = 0; i < lookups; i++) {
+        PageId pid;
+        nonleaf->locateChildPtr(searchKeys[i], pid);
+        checksum += pid;
+      }
+      double nonleafNs = nsPerLookup(begin, lookups);
+
+      printf("%9d %5d%% %8d %12.1f %12.1f\n", pageSizes[p], fills[f], keys, leafNs, nonleafNs);
+      delete leaf;
+      delete nonleaf;
+    }
+  }
+
+  // print the checksum so that the searches are not optimized away
+  fprintf(stderr, "checksum: %lld\n", checksum);
+  return 0;
+}
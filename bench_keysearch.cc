@@ -0,0 +1,144 @@
+/**
+ * Benchmark of the key search kernels of the B+tree nodes.
+ *
+ * The keys of movie.del are loaded into a leaf node and a nonleaf node of
+ * every page size (as many keys as fit, evenly spaced), and the nodes are
+ * searched with the keys of movie.del in two orders: a random order and
+ * the sorted order of a range scan. Every kernel that the CPU supports
+ * is measured, and the number of lookups per second is reported.
+ *
+ * usage: bench_keysearch [loadfile] [# of lookups per measurement]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "BTreeNode.h"
+
+using namespace std;
+
+// read the keys of a load file, the integers before the first comma of each line
+static RC readKeys(const char* loadfile, vector<int>& keys)
+{
+  ifstream in(loadfile);
+  string line;
+
+  if (!in.is_open()) return RC_FILE_OPEN_FAILED;
+  while (getline(in, line)) {
+    if (!line.empty()) keys.push_back(atoi(line.c_str()));
+  }
+  return keys.empty() ? RC_FILE_READ_FAILED : 0;
+}
+
+// lookups per second of stream against leaf. checksum is the sum of the found entries
+static double leafRate(BTLeafNode& leaf, const vector<int>& stream, long long& checksum)
+{
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < stream.size(); i++) {
+    int eid;
+    leaf.locate(stream[i], eid);
+    checksum += eid;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+  return stream.size() / elapsed.count();
+}
+
+// lookups per second of stream against nonleaf. checksum is the sum of the children
+static double nonLeafRate(BTNonLeafNode& nonleaf, const vector<int>& stream, long long& checksum)
+{
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < stream.size(); i++) {
+    PageId pid;
+    nonleaf.locateChildPtr(stream[i], pid);
+    checksum += pid;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+  return stream.size() / elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const char* loadfile = (argc > 1) ? argv[1] : "movie.del";
+  int lookups = (argc > 2) ? atoi(argv[2]) : 4000000;
+  const int pageSizes[] = { 1024, 4096, 16384, 65536 };
+  const int kernels[] = { BTKeySearch::SCALAR, BTKeySearch::AVX2, BTKeySearch::AVX512 };
+  const int defaultKernel = BTKeySearch::getKernel();
+  vector<int> keys;
+  RC rc;
+
+  if ((rc = readKeys(loadfile, keys)) < 0) {
+    fprintf(stderr, "Error: cannot read the keys of %s\n", loadfile);
+    return 1;
+  }
+
+  // the random stream repeats movie.del in a shuffled order,
+  // the sequential stream repeats its keys in the sorted order
+  vector<int> random, sequential;
+  vector<int> sorted(keys);
+  sort(sorted.begin(), sorted.end());
+  mt19937 gen(1);
+  while ((int) random.size() < lookups) {
+    shuffle(keys.begin(), keys.end(), gen);
+    random.insert(random.end(), keys.begin(), keys.end());
+    sequential.insert(sequential.end(), sorted.begin(), sorted.end());
+  }
+  random.resize(lookups);
+  sequential.resize(lookups);
+
+  // the node keys are the distinct keys of movie.del
+  sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+  printf("%d keys from %s, %d lookups per measurement, default kernel: %s\n",
+         (int) keys.size(), loadfile, lookups, BTKeySearch::getName(defaultKernel));
+  printf("%9s %6s %10s %8s %16s %16s\n", "page size", "keys", "stream", "kernel",
+         "leaf (M/sec)", "nonleaf (M/sec)");
+
+  for (size_t p = 0; p < sizeof(pageSizes) / sizeof(int); p++) {
+    BTLeafNode* leaf = new BTLeafNode(pageSizes[p]);
+    BTNonLeafNode* nonleaf = new BTNonLeafNode(pageSizes[p]);
+    int leafKeys = min((int) sorted.size(), leaf->getMaxKeyCount());
+    int nonleafKeys = min((int) sorted.size(), nonleaf->getMaxKeyCount());
+    RecordId rid = { 0, 0 };
+
+    // spread the keys evenly, so that the node covers the range of movie.del
+    for (int i = 0; i < leafKeys; i++)
+      leaf->insert(sorted[(long long) i * sorted.size() / leafKeys], rid);
+    nonleaf->initializeRoot(0, sorted[0], 1);
+    for (int i = 1; i < nonleafKeys; i++)
+      nonleaf->insert(sorted[(long long) i * sorted.size() / nonleafKeys], i + 1);
+
+    for (int s = 0; s < 2; s++) {
+      const vector<int>& stream = (s == 0) ? random : sequential;
+      long long expected = 0;
+
+      for (size_t k = 0; k < sizeof(kernels) / sizeof(int); k++) {
+        if (BTKeySearch::setKernel(kernels[k]) < 0) continue;
+
+        // every kernel must find the same entries as the scalar kernel
+        long long checksum = 0;
+        double leafPerSec = leafRate(*leaf, stream, checksum);
+        double nonleafPerSec = nonLeafRate(*nonleaf, stream, checksum);
+        if (k == 0) expected = checksum;
+        else if (checksum != expected) {
+          fprintf(stderr, "Error: the %s kernel disagrees with the scalar kernel\n",
+                  BTKeySearch::getName(kernels[k]));
+          return 1;
+        }
+
+        printf("%9d %6d %10s %8s %16.1f %16.1f\n", pageSizes[p], leafKeys,
+               (s == 0) ? "random" : "sequential", BTKeySearch::getName(kernels[k]),
+               leafPerSec / 1e6, nonleafPerSec / 1e6);
+      }
+    }
+    delete leaf;
+    delete nonleaf;
+  }
+
+  BTKeySearch::setKernel(defaultKernel);
+  return 0;
+}
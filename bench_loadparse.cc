@@ -0,0 +1,109 @@
+/**
+ * Benchmark of the load file parsers.
+ *
+ * A load file is replicated until it is large enough (movie.del repeated
+ * to about 256 MB by default), and parsed in two ways: line by line with
+ * getline() and SqlEngine::parseLoadLine(), and in place by LoadFile from
+ * a memory mapping. Both parsers must produce the same tuples, and the
+ * number of lines and megabytes parsed per second are reported.
+ *
+ * usage: bench_loadparse [loadfile] [MB to replicate it to]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include "SqlEngine.h"
+#include "LoadFile.h"
+
+using namespace std;
+
+// a checksum of a tuple, so that the parsers can be compared
+static inline unsigned long long mix(unsigned long long sum, int key, const char* value, int length)
+{
+  sum = sum * 31 + (unsigned) key;
+  for (int i = 0; i < length; i++) sum = sum * 131 + (unsigned char) value[i];
+  return sum;
+}
+
+int main(int argc, char** argv)
+{
+  const char* loadfile = (argc > 1) ? argv[1] : "movie.del";
+  long long target = ((argc > 2) ? atoll(argv[2]) : 256) << 20;
+  const char* bigfile = "bench_loadparse.del";
+  string content, line, value;
+  long long size = 0, lines = 0, tuples = 0;
+  unsigned long long expected = 0, checksum = 0;
+  int key;
+
+  // replicate the load file
+  ifstream in(loadfile, ios::in | ios::binary);
+  if (!in.is_open()) {
+    fprintf(stderr, "Error: cannot open %s\n", loadfile);
+    return 1;
+  }
+  content.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  if (content.empty()) {
+    fprintf(stderr, "Error: %s is empty\n", loadfile);
+    return 1;
+  }
+  if (content[content.size() - 1] != '\n') content += '\n';
+  FILE* out = fopen(bigfile, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "Error: cannot create %s\n", bigfile);
+    return 1;
+  }
+  for (; size < target; size += content.size())
+    fwrite(content.data(), 1, content.size(), out);
+  fclose(out);
+  printf("%s replicated to %.1f MB in %s\n", loadfile, size / 1048576.0, bigfile);
+
+  // getline() and parseLoadLine()
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  ifstream big(bigfile);
+  while (getline(big, line)) {
+    lines++;
+    if (!SqlEngine::parseLoadLine(line, key, value)) {
+      expected = mix(expected, key, value.data(), value.size());
+      tuples++;
+    }
+  }
+  big.close();
+  chrono::duration<double> getlineSec = chrono::steady_clock::now() - t0;
+
+  // LoadFile, mapped and parsed in place
+  chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+  LoadFile file;
+  LoadBatch batch;
+  long long mappedTuples = 0;
+  if (file.open(bigfile) < 0) {
+    fprintf(stderr, "Error: cannot map %s\n", bigfile);
+    return 1;
+  }
+  for (size_t begin = 0, end; begin < file.size(); begin = end) {
+    end = file.chunkEnd(begin, 1 << 20);
+    batch.clear();
+    file.parse(begin, end, batch);
+    for (unsigned i = 0; i < batch.keys.size(); i++)
+      checksum = mix(checksum, batch.keys[i], batch.values[i], batch.lengths[i]);
+    mappedTuples += batch.keys.size();
+  }
+  file.close();
+  chrono::duration<double> mappedSec = chrono::steady_clock::now() - t1;
+  remove(bigfile);
+
+  if (checksum != expected || mappedTuples != tuples) {
+    fprintf(stderr, "Error: the parsers disagree\n");
+    return 1;
+  }
+
+  printf("%-28s %12s %12s\n", "parser", "M lines/sec", "MB/sec");
+  printf("%-28s %12.2f %12.1f\n", "getline + parseLoadLine", lines / getlineSec.count() / 1e6,
+         size / getlineSec.count() / 1048576);
+  printf("%-28s %12.2f %12.1f\n", "LoadFile (mmap, structural)", lines / mappedSec.count() / 1e6,
+         size / mappedSec.count() / 1048576);
+  printf("speedup: %.1fx\n", getlineSec.count() / mappedSec.count());
+  return 0;
+}
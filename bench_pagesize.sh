@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Compare LOAD, table scan and index lookup times, and the sizes of the
+# table and its index, for different page sizes.
+# usage: ./bench_pagesize.sh [copies of movie.del]
+#
+# The data file is movie.del replicated with unique keys, so that the table
+# is large enough for the page size to matter.
+
+COPIES=${1:-50}
+DIR=bench.tmp
+
+rm -rf $DIR
+mkdir $DIR
+awk -F, -v n=$COPIES '{ rows[NR] = $0; keys[NR] = $1 }
+  END { for (i = 0; i < n; i++) for (r = 1; r <= NR; r++) {
+          line = rows[r]; sub(/^[^,]*/, keys[r] + i * 10000, line); print line } }' \
+  movie.del > $DIR/bench.del
+
+for size in 1024 4096 8192 16384 65536
+do
+  rm -f $DIR/bench.tbl $DIR/bench.idx $DIR/bench.stat
+  echo "== page size $size"
+  start=$(date +%s.%N)
+  (cd $DIR && echo "LOAD bench FROM 'bench.del' WITH INDEX" | ../bruinbase -p $size > /dev/null)
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{ printf "  -- %.3f seconds to load the table and build the index\n", $2 - $1 }'
+
+  # a table scan (the condition on the value keeps the index out), an
+  # index lookup, an index range scan and an index count
+  (cd $DIR && ../bruinbase -p $size <<SQL
+SELECT COUNT(*) FROM bench WHERE value > ''
+SELECT key FROM bench WHERE key = 12345
+SELECT * FROM bench WHERE key > 10000 AND key < 10100
+SELECT COUNT(*) FROM bench WHERE key > 10000 AND key < 20000
+SQL
+  ) 2>&1 | grep -oE -- "-- .*seconds.*" | sed 's/^/  /'
+
+  # the first page of a file is its header
+  for file in tbl idx
+  do
+    ls -l $DIR/bench.$file | awk -v size=$size -v file=$file \
+      '{ printf "  %s: %d bytes, %d pages\n", file, $5, $5 / size - 1 }'
+  done
+done
+
+rm -rf $DIR
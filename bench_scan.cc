@@ -0,0 +1,176 @@
+/**
+ * Benchmark of the predicate evaluation of a table scan.
+ *
+ * A table of synthetic tuples is created (or reused, if a table of the
+ * same size exists), and scanned with a few WHERE clauses in two ways:
+ * the tuple-at-a-time loop that parses and compares every condition for
+ * every tuple, and the page-at-a-time ScanFilter with a selection vector.
+ * The scans must select the same tuples, and the number of tuples
+ * scanned per second is reported.
+ *
+ * The table is created with the slotted page format, or with the fixed
+ * format if "fixed" is given, so that the scans of both can be compared.
+ *
+ * usage: bench_scan [# of tuples] [table file] [fixed]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "RecordFile.h"
+#include "ScanFilter.h"
+
+using namespace std;
+
+// create a table of count tuples with random keys and short titles as values
+static RC createTable(const char* filename, int count)
+{
+  RecordFile rf;
+  RecordId   rid;
+  char       value[32];
+  mt19937    gen(1);
+  RC         rc;
+
+  remove(filename);
+  if ((rc = rf.open(filename, 'w')) < 0) return rc;
+  for (int i = 0; i < count; i++) {
+    snprintf(value, sizeof(value), "%c%c title %d", 'A' + (int) (gen() % 26),
+             'a' + (int) (gen() % 26), i);
+    if ((rc = rf.append((int) (gen() % 10000000), value, rid)) < 0) break;
+  }
+  rf.close();
+  return rc;
+}
+
+// the tuple-at-a-time scan. returns the # of matching tuples, or an error code
+static long long tupleScan(const RecordFile& rf, const vector<SelCond>& cond)
+{
+  RecordCursor scan;
+  RecordId     rid;
+  int          key, diff = 0;
+  const char*  val;
+  long long    count = 0;
+  RC           rc;
+
+  scan.open(rf, 8);
+  while ((rc = scan.next(rid, key, val)) == 0) {
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].attr == 1)
+        diff = (key > atoi(cond[i].value)) - (key < atoi(cond[i].value));
+      else
+        diff = strcmp(val, cond[i].value);
+
+      switch (cond[i].comp) {
+      case SelCond::EQ: if (diff != 0) goto next_tuple; break;
+      case SelCond::NE: if (diff == 0) goto next_tuple; break;
+      case SelCond::GT: if (diff <= 0) goto next_tuple; break;
+      case SelCond::LT: if (diff >= 0) goto next_tuple; break;
+      case SelCond::GE: if (diff < 0) goto next_tuple; break;
+      case SelCond::LE: if (diff > 0) goto next_tuple; break;
+      }
+    }
+    count++;
+    next_tuple: ;
+  }
+  return (rc == RC_NO_SUCH_RECORD) ? count : rc;
+}
+
+// the page-at-a-time scan. returns the # of matching tuples, or an error code
+static long long pageScan(const RecordFile& rf, const vector<SelCond>& cond)
+{
+  RecordCursor scan;
+  RecordId     rid;
+  ScanFilter   filter(cond);
+  int          perPage = rf.getRecordsPerPage();
+  vector<int>  keys(perPage), sel(perPage);
+  vector<const char*> values(perPage);
+  long long    count = 0;
+  int          n;
+  RC           rc;
+
+  scan.open(rf, 8);
+  while ((rc = scan.nextPage(rid, &keys[0], &values[0], n)) == 0)
+    count += filter.filter(&keys[0], &values[0], n, &sel[0]);
+  return (rc == RC_NO_SUCH_RECORD) ? count : rc;
+}
+
+static SelCond makeCond(int attr, SelCond::Comparator comp, const char* value)
+{
+  SelCond c;
+  c.attr = attr;
+  c.comp = comp;
+  c.value = const_cast<char*>(value);
+  return c;
+}
+
+int main(int argc, char** argv)
+{
+  int tuples = (argc > 1) ? atoi(argv[1]) : 10000000;
+  const char* filename = (argc > 2) ? argv[2] : "bench_scan.tbl";
+  int format = (argc > 3 && strcmp(argv[3], "fixed") == 0) ? RecordFile::FORMAT_FIXED
+                                                            : RecordFile::FORMAT_SLOTTED;
+  RecordFile rf;
+  RC rc;
+
+  // reuse the table if it has the requested size and format
+  RecordFile::setDefaultFormat(format);
+  if (rf.open(filename, 'r') < 0 || rf.getFormat() != format ||
+      pageScan(rf, vector<SelCond>()) != tuples) {
+    rf.close();
+    printf("creating a table of %d tuples in %s\n", tuples, filename);
+    if ((rc = createTable(filename, tuples)) < 0 || (rc = rf.open(filename, 'r')) < 0) {
+      fprintf(stderr, "Error: cannot create %s\n", filename);
+      return 1;
+    }
+  }
+  rf.setAccessPattern(PageFile::ACCESS_SEQUENTIAL);
+  printf("%d tuples in %d pages (%s format)\n", tuples,
+         rf.endRid().pid + (rf.endRid().sid > 0),
+         (format == RecordFile::FORMAT_FIXED) ? "fixed" : "slotted");
+
+  struct Query {
+    const char* text;
+    vector<SelCond> cond;
+  } queries[5];
+  queries[0].text = "no condition";
+  queries[1].text = "key > 4000000 AND key < 5000000";
+  queries[1].cond.push_back(makeCond(1, SelCond::GT, "4000000"));
+  queries[1].cond.push_back(makeCond(1, SelCond::LT, "5000000"));
+  queries[2].text = "key <> 42 AND key <> 4242";
+  queries[2].cond.push_back(makeCond(1, SelCond::NE, "42"));
+  queries[2].cond.push_back(makeCond(1, SelCond::NE, "4242"));
+  queries[3].text = "value > 'M' AND value < 'N'";
+  queries[3].cond.push_back(makeCond(2, SelCond::GT, "M"));
+  queries[3].cond.push_back(makeCond(2, SelCond::LT, "N"));
+  queries[4].text = "key >= 1000000 AND key <= 3000000 AND value < 'C'";
+  queries[4].cond.push_back(makeCond(1, SelCond::GE, "1000000"));
+  queries[4].cond.push_back(makeCond(1, SelCond::LE, "3000000"));
+  queries[4].cond.push_back(makeCond(2, SelCond::LT, "C"));
+
+  printf("%-50s %10s %18s %18s %8s\n", "WHERE", "matches", "tuple (M/sec)", "page (M/sec)", "speedup");
+  for (int q = 0; q < 5; q++) {
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    long long expected = tupleScan(rf, queries[q].cond);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    long long count = pageScan(rf, queries[q].cond);
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+    if (expected < 0 || count != expected) {
+      fprintf(stderr, "Error: the scans of \"%s\" disagree (%lld, %lld)\n",
+              queries[q].text, expected, count);
+      return 1;
+    }
+
+    double tupleSec = chrono::duration<double>(t1 - t0).count();
+    double pageSec = chrono::duration<double>(t2 - t1).count();
+    printf("%-50s %10lld %18.1f %18.1f %7.1fx\n", queries[q].text, count,
+           tuples / tupleSec / 1e6, tuples / pageSec / 1e6, tupleSec / pageSec);
+  }
+
+  rf.close();
+  return 0;
+}
@@ -7,16 +7,69 @@
  * @date 3/24/2008
  */
  
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
 // #include "BTreeNodeTest.h"
  #include "BTreeNode.h"
  #include <iostream>
  using namespace std;
 
 
-int main()
+static void usage(const char* prog)
 {
+  fprintf(stderr, "usage: %s [-b buffer_pool_mb] [-n] [-p page_size] [-f fill_percent] [-t threads] [-W]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+
+  // parse the startup options
+  while ((opt = getopt(argc, argv, "b:np:f:t:W")) != -1) {
+    switch (opt) {
+    case 'b':  // size of the buffer pool in MB
+      if (PageFile::setCacheSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: cannot allocate a %s MB buffer pool\n", optarg);
+        return 1;
+      }
+      break;
+    case 'n':  // do not memory-map read-only files
+      PageFile::setMmapEnabled(false);
+      break;
+    case 'p':  // page size of the tables and indexes created by LOAD
+      if (PageFile::setDefaultPageSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: page size must be a power of two between %d and %d\n",
+                PageFile::MIN_PAGE_SIZE, PageFile::MAX_PAGE_SIZE);
+        return 1;
+      }
+      break;
+    case 'f':  // fill factor of the indexes built by LOAD
+      if (atoi(optarg) < 1 || atoi(optarg) > 100) {
+        fprintf(stderr, "Error: fill factor must be between 1 and 100\n");
+        return 1;
+      }
+      SqlEngine::setIndexFillFactor(atoi(optarg));
+      break;
+    case 't':  // # of threads that scan a table or parse a load file
+      if (atoi(optarg) < 1) {
+        fprintf(stderr, "Error: the number of threads must be at least 1\n");
+        return 1;
+      }
+      SqlEngine::setThreads(atoi(optarg));
+      break;
+    case 'W':  // write every page through to the disk right away
+      PageFile::setWriteBack(false);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
   // run the SQL engine taking user commands from standard input (console).
 
   // Tester
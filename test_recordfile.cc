@@ -0,0 +1,108 @@
+/**
+ * Test of RecordFile::bufferedAppend().
+ *
+ * Records are appended with bufferedAppend() to a table of small pages,
+ * in both page formats, with some values long enough to need overflow
+ * pages (in the fixed format, they are truncated).
+ * Every record must be readable by read() and by a RecordCursor right
+ * after it is appended, while its page is still held in memory, and
+ * again after the table is flushed, closed and opened again.
+ *
+ * usage: test_recordfile
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "RecordFile.h"
+
+using namespace std;
+
+static const char* TABLE = "test_recordfile.tbl";
+static const char* OVERFLOW_FILE = "test_recordfile.tbl.ovf";
+
+// the value of the i-th record. every tenth value is too long for a record,
+// so it continues in overflow pages, or is truncated in the fixed format
+static string valueOf(int i, int format)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "value %d ", i);
+  string value(buffer);
+  if (i % 10 == 9) value.append(150 + i % 7, 'a' + i % 26);
+  if (format == RecordFile::FORMAT_FIXED)
+    value.resize(min<size_t>(value.size(), RecordFile::VALUE_PREFIX_LENGTH));
+  return value;
+}
+
+// check the first count records with read() and with a RecordCursor
+static void checkRecords(const RecordFile& rf, const vector<RecordId>& rids, int count)
+{
+  RecordCursor cursor;
+  RecordId     rid;
+  int          key;
+  string       value, whole;
+  const char*  ptr;
+
+  for (int i = 0; i < count; i++) {
+    assert(rf.read(rids[i], key, value) == 0);
+    assert(key == i && value == valueOf(i, rf.getFormat()));
+  }
+
+  assert(cursor.open(rf) == 0);
+  for (int i = 0; i < count; i++) {
+    assert(cursor.next(rid, key, ptr) == 0);
+    assert(rid == rids[i] && key == i);
+    assert(rf.readValue(ptr, whole) == 0 && whole == valueOf(i, rf.getFormat()));
+  }
+  assert(cursor.next(rid, key, ptr) == RC_NO_SUCH_RECORD);
+  cursor.close();
+}
+
+static void testBufferedAppend(int format, bool writeBack)
+{
+  const int COUNT = 500;
+  RecordFile rf;
+  vector<RecordId> rids(COUNT);
+
+  remove(TABLE);
+  remove(OVERFLOW_FILE);
+  PageFile::setWriteBack(writeBack);
+  assert(RecordFile::setDefaultFormat(format) == 0);
+  assert(rf.open(TABLE, 'w') == 0);
+
+  // the records of the page being filled are read before it is written
+  for (int i = 0; i < COUNT; i++) {
+    assert(rf.bufferedAppend(i, valueOf(i, format), rids[i]) == 0);
+    if (i % 37 == 0 || i == COUNT - 1) checkRecords(rf, rids, i + 1);
+  }
+  assert(rids[COUNT - 1].pid > 0);
+
+  // and after it is written
+  assert(rf.flush() == 0);
+  checkRecords(rf, rids, COUNT);
+  assert(rf.close() == 0);
+
+  assert(rf.open(TABLE, 'r') == 0);
+  checkRecords(rf, rids, COUNT);
+  assert(rf.close() == 0);
+
+  remove(TABLE);
+  remove(OVERFLOW_FILE);
+  printf("bufferedAppend, %s pages%s: %d records in %d pages OK\n",
+         format == RecordFile::FORMAT_FIXED ? "fixed" : "slotted",
+         writeBack ? ", write-back" : "", COUNT, rids[COUNT - 1].pid + 1);
+}
+
+int main()
+{
+  assert(PageFile::setDefaultPageSize(1024) == 0);
+  testBufferedAppend(RecordFile::FORMAT_FIXED, false);
+  testBufferedAppend(RecordFile::FORMAT_SLOTTED, false);
+
+  // with write-back, the written pages stay dirty in the buffer pool
+  testBufferedAppend(RecordFile::FORMAT_FIXED, true);
+  testBufferedAppend(RecordFile::FORMAT_SLOTTED, true);
+  return 0;
+}